@@ -33,11 +33,22 @@ typedef struct {
 static const uint64_t notAFile = 0xfefefefefefefefe; // ~0x0101010101010101
 static const uint64_t notHFile = 0x7f7f7f7f7f7f7f7f; // ~0x8080808080808080
 
+static const uint64_t darkSquares  = 0xaa55aa55aa55aa55;
+static const uint64_t lightSquares = 0x55aa55aa55aa55aa;
+
 static inline uint64_t get_sqr(int file, int rank) { return (uint64_t) 1ULL << (8*rank+file); }
 
 static inline int get_rank(const int sqr) { return sqr / 8; }
 static inline int get_file(const int sqr) { return sqr % 8; }
 
+static inline int kingDistance(const int a, const int b) {
+	return max(abs(get_file(a) - get_file(b)), abs(get_rank(a) - get_rank(b)));
+}
+
+static inline int centerDistance(const int sqr) {
+	return max(3 - get_file(sqr), get_file(sqr) - 4) + max(3 - get_rank(sqr), get_rank(sqr) - 4);
+}
+
 static inline uint64_t setBit  (uint64_t *bb, int i) { return *bb |= bitmask[i]; }
 static inline uint64_t unsetBit(uint64_t *bb, int i) { return *bb &= ~bitmask[i]; }
 
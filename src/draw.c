@@ -1,14 +1,31 @@
 #include "board.h"
 #include "draw.h"
+#include "magic.h"
+#include "hashtables.h"
 
 
-static int threeFoldRepetition(const Board *board);
+static int repetition(const Board *board, const int ply);
 static int insufficientMaterial(const Board *board);
 
+static inline int cuckooH1(const uint64_t key) { return key & (CUCKOO_SIZE - 1); }
+static inline int cuckooH2(const uint64_t key) { return (key >> 16) & (CUCKOO_SIZE - 1); }
+
 Memory memory = {.size = 0};
 
-int isDraw(const Board *board) {
-	if (threeFoldRepetition(board)) {
+/*
+ * Cuckoo tables with the key of every reversible move, that is, every move of
+ * a piece other than a pawn on an empty board. They are used to find the moves
+ * that lead to a position that has already been played.
+ */
+static uint64_t cuckooKeys[CUCKOO_SIZE];
+static uint16_t cuckooMoves[CUCKOO_SIZE];
+
+/*
+ * The ply is the distance to the root of the search. Positions repeated
+ * after the root are a draw, since the side that can avoid it would.
+ */
+int isDraw(const Board *board, const int ply) {
+	if (repetition(board, ply)) {
 		//printf("3fold repetition\n");
 		return 1;
 	}
@@ -69,15 +86,23 @@ static int insufficientMaterial(const Board *board) {
 }
 
 
-static int threeFoldRepetition(const Board *board) {
-	int counter = 0;
+/*
+ * Only the positions since the last irreversible move with the same
+ * side to move are compared. The position before it in memory has the
+ * other side to move, and the one before that can't be equal either.
+ */
+static int repetition(const Board *board, const int ply) {
+	const int current = memory.size - 1;
+	const int end = max(0, current - board->fiftyMoves);
 
-	ASSERT(memory.size == board->ply);
-	ASSERT(memory.size - board->fiftyMoves - 1 >= 0)
+	ASSERT(memory.keys[current] == board->key);
 
-	for (int i = 0; i < memory.size; ++i) {
-		if (board->key == memory.keys[i]) {
-			if (++counter == 3)
+	int counter = 0;
+
+	for (int i = current - 4; i >= end; i -= 2) {
+		if (memory.keys[i] == board->key) {
+			// A twofold repetition inside the tree or a threefold one
+			if (current - i < ply || ++counter == 2)
 				return 1;
 		}
 	}
@@ -85,6 +110,98 @@ static int threeFoldRepetition(const Board *board) {
 	return 0;
 }
 
+void initCuckoo(void) {
+	for (int i = 0; i < CUCKOO_SIZE; ++i) {
+		cuckooKeys[i] = 0;
+		cuckooMoves[i] = 0;
+	}
+
+	int count = 0;
+
+	for (int color = WHITE; color <= BLACK; ++color) {
+		for (int piece = KNIGHT; piece <= KING; ++piece) {
+			for (int from = 0; from < 64; ++from) {
+
+				uint64_t targets;
+
+				switch (piece) {
+				case KNIGHT: targets = knightLookup[from]; break;
+				case BISHOP: targets = bishopAttacks(from, 0); break;
+				case ROOK:   targets = rookAttacks(from, 0); break;
+				case QUEEN:  targets = bishopAttacks(from, 0) | rookAttacks(from, 0); break;
+				default:     targets = kingLookup[from]; break;
+				}
+
+				// Each move is saved once, as a move and its reverse have the same key
+				targets &= ~(bitmask[from] - 1) & ~bitmask[from];
+
+				if (targets) do {
+					const int to = bitScanForward(targets);
+
+					uint64_t key = moveKey(color, piece, from, to);
+					uint16_t move = from | (to << 6);
+
+					// Inserts the entry, moving the previous ones to their other slot
+					int index = cuckooH1(key);
+
+					while (1) {
+						uint64_t tmpKey = cuckooKeys[index];
+						uint16_t tmpMove = cuckooMoves[index];
+
+						cuckooKeys[index] = key;
+						cuckooMoves[index] = move;
+
+						if (tmpMove == 0)
+							break;
+
+						key = tmpKey;
+						move = tmpMove;
+						index = (index == cuckooH1(key)) ? cuckooH2(key) : cuckooH1(key);
+					}
+
+					++count;
+				} while (unsetLSB(targets));
+			}
+		}
+	}
+
+	ASSERT(count == 3668);
+	(void) count;
+}
+
+/*
+ * Tells if the side to move has a move that goes back to a position played
+ * inside the tree, which would allow it to draw. Earlier positions that differ
+ * from the current one by a single piece move are found in the cuckoo tables.
+ */
+int upcomingRepetition(const Board *board, const int ply) {
+	const int current = memory.size - 1;
+	const int end = min(board->fiftyMoves, ply - 1);
+
+	for (int i = 3; i <= end; i += 2) {
+		const uint64_t key = board->key ^ memory.keys[current - i];
+
+		int index = cuckooH1(key);
+
+		if (cuckooKeys[index] != key) {
+			index = cuckooH2(key);
+
+			if (cuckooKeys[index] != key)
+				continue;
+		}
+
+		const int from = cuckooMoves[index] & 0x3f;
+		const int to   = cuckooMoves[index] >> 6;
+
+		// The piece has to be ours and its path has to be free
+		if ((board->players[board->turn] & (bitmask[from] | bitmask[to])) &&
+			!(inBetweenLookup[from][to] & board->occupied))
+			return 1;
+	}
+
+	return 0;
+}
+
 void saveKeyToMemory(const uint64_t key) {
 	ASSERT(memory.size >= 0 && memory.size < MAX_GAME_LENGTH);
 
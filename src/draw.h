@@ -11,6 +11,7 @@
 #include "main.h"
 #include "eval.h"
 
+#define CUCKOO_SIZE 8192
 
 typedef struct {
 	uint64_t keys[MAX_GAME_LENGTH];
@@ -18,7 +19,10 @@ typedef struct {
 } Memory;
 
 
-int isDraw(const Board *board);
+int isDraw(const Board *board, const int ply);
+
+void initCuckoo(void);
+int upcomingRepetition(const Board *board, const int ply);
 
 void saveKeyToMemory(const uint64_t key);
 void freeKeyFromMemory(void);
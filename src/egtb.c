@@ -0,0 +1,725 @@
+#include <string.h>
+#include <limits.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "board.h"
+#include "play.h"
+#include "magic.h"
+#include "pawns.h"
+#include "egtb.h"
+
+/*
+ * Endgame tables for all the 3 and 4 piece endings.
+ *
+ * Every table stores a byte per position, from the point of view of the side to move:
+ *   0:        draw
+ *   1-127:    win, mate in that many plies
+ *   128-253:  loss, mated in (value - 128) plies
+ *   255:      illegal position
+ *
+ * The tables are generated by iterating over all the positions with the regular
+ * move generator until no more can be resolved. Captures and promotions are
+ * looked up in the tables of smaller or pawnless endings, which are generated first.
+ * Each iteration is split among several threads, and only visits the positions
+ * that can reach one resolved in the previous iteration.
+ *
+ * Positions are indexed by the squares of the pieces. The strong side is always
+ * white and the symmetries of the board are used to place the white king on
+ * a1-d1-d4 (10 squares) for pawnless endings or on files a-d (32 squares).
+ */
+
+#define MAX_TABLES 36
+
+#define DRAW_VALUE 0
+#define LOSS_VALUE 128
+#define UNKNOWN_VALUE 254
+#define ILLEGAL_VALUE 255
+
+typedef struct {
+	char name[8];
+
+	uint64_t key;
+	uint64_t flippedKey;
+
+	int nPieces;
+	int extra[2];		// color * PIECES + piece of the pieces besides the kings
+	int pawns;
+	int enPassant;		// Both sides have pawns
+
+	uint64_t size;
+	uint8_t *data;
+
+	int mapped;
+	int maxPly;
+} Table;
+
+typedef struct {
+	Table *table;
+
+	uint64_t *dirty;
+	uint64_t *nextDirty;
+
+	uint64_t start;
+	uint64_t end;
+
+	int ply;
+	int maxPly;
+} Worker;
+
+static Table tables[MAX_TABLES];
+static int nTables = 0;
+
+static void initTables(const int maxPieces);
+static void unmapTables(void);
+static void addTable(const int white1, const int white2, const int black);
+
+static void generateTable(Table *table, const int threads);
+static void *generateRange(void *args);
+
+static int resolve(Board *board, const int ply, int *pending);
+static int childValue(Board *board, const int ply);
+static void markPredecessors(const Table *table, const Board *board, uint64_t *dirty);
+static int probeValue(const Board *board);
+
+static Table *findTable(const Board *board, int *flip);
+static uint64_t tableIndex(const Table *table, const Board *board, const int flip);
+static uint64_t squaresIndex(const Table *table, int *sqrs, const int turn);
+static int indexToBoard(const Table *table, uint64_t index, Board *board);
+
+static uint64_t materialKey(int counts[2][PIECES]);
+
+static inline uint64_t min64(const uint64_t a, const uint64_t b) { return (a < b) ? a : b; }
+
+static inline int isWin (const int value) { return value >= 1 && value < LOSS_VALUE; }
+static inline int isLoss(const int value) { return value >= LOSS_VALUE && value < UNKNOWN_VALUE; }
+
+static inline int loadValue (const uint8_t *ptr) { return __atomic_load_n(ptr, __ATOMIC_RELAXED); }
+static inline void storeValue(uint8_t *ptr, const int value) { __atomic_store_n(ptr, value, __ATOMIC_RELAXED); }
+
+static inline int isDirty(const uint64_t *dirty, const uint64_t i) { return (dirty[i / 64] >> (i % 64)) & 1; }
+static inline void setDirty(uint64_t *dirty, const uint64_t i) { __atomic_fetch_or(&dirty[i / 64], 1ULL << (i % 64), __ATOMIC_RELAXED); }
+
+static const char pieceLetters[PIECES] = {'P', 'N', 'B', 'R', 'Q', 'K'};
+
+// Index of the squares in the a1-d1-d4 triangle
+static const int triangle[64] = {
+	 0,  1,  2,  3, -1, -1, -1, -1,
+	-1,  4,  5,  6, -1, -1, -1, -1,
+	-1, -1,  7,  8, -1, -1, -1, -1,
+	-1, -1, -1,  9, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1
+};
+
+static const int triangleSqrs[10] = {0, 1, 2, 3, 9, 10, 11, 18, 19, 27};
+
+
+/*
+ * Generates every table with up to maxPieces pieces and writes them to path.
+ */
+void generateEGTB(const char *path, const int maxPieces, const int threads) {
+	char filename[PATH_MAX];
+
+	// The tables loaded before are listed again, so their files are released first
+	unmapTables();
+	initTables(maxPieces);
+	mkdir(path, 0755);
+
+	for (int i = 0; i < nTables; ++i) {
+		Table *table = &tables[i];
+
+		fprintf(stdout, "Generating %s... ", table->name);
+		fflush(stdout);
+
+		generateTable(table, threads);
+
+		FILE *fp = NULL;
+
+		if (snprintf(filename, sizeof(filename), "%s/%s.egt", path, table->name) < (int) sizeof(filename))
+			fp = fopen(filename, "wb");
+
+		if (fp == NULL || fwrite(table->data, 1, table->size, fp) != table->size) {
+			fprintf(stdout, "There was an error writing the file %s\n", filename);
+			fflush(stdout);
+		}
+
+		if (fp != NULL)
+			fclose(fp);
+
+		fprintf(stdout, "longest mate: %d plies\n", table->maxPly);
+		fflush(stdout);
+	}
+
+	// The generated tables are replaced by their mapped files
+	for (int i = 0; i < nTables; ++i)
+		free(tables[i].data);
+
+	nTables = 0;
+	loadEGTB(path);
+}
+
+/*
+ * Maps every table file found in path. Returns the number of tables loaded.
+ */
+int loadEGTB(const char *path) {
+	char filename[PATH_MAX];
+	int loaded = 0;
+
+	unmapTables();
+	initTables(EGTB_PIECES);
+
+	for (int i = 0; i < nTables; ++i) {
+		Table *table = &tables[i];
+
+		// A path too long for the file name can't be opened
+		if (snprintf(filename, sizeof(filename), "%s/%s.egt", path, table->name) >= (int) sizeof(filename))
+			break;
+
+		const int fd = open(filename, O_RDONLY);
+
+		if (fd == -1)
+			continue;
+
+		struct stat st;
+
+		if (fstat(fd, &st) == 0 && (uint64_t) st.st_size == table->size) {
+			void *data = mmap(NULL, table->size, PROT_READ, MAP_SHARED, fd, 0);
+
+			if (data != MAP_FAILED) {
+				table->data = data;
+				table->mapped = 1;
+				++loaded;
+			}
+		}
+
+		close(fd);
+	}
+
+	return loaded;
+}
+
+/*
+ * Scores a position found in the tables. Returns 0 if it's not in them.
+ * Positions with castling rights or an en passant square aren't indexed.
+ */
+int probeEGTB(const Board *board, int *score) {
+	if (popCount(board->occupied) > EGTB_PIECES || board->castling || board->enPassant)
+		return 0;
+
+	int flip;
+	const Table *table = findTable(board, &flip);
+
+	if (table == NULL || table->data == NULL)
+		return 0;
+
+	const int value = table->data[tableIndex(table, board, flip)];
+
+	if (isWin(value))
+		*score = TB_WIN - value;
+	else if (isLoss(value))
+		*score = -TB_WIN + (value - LOSS_VALUE);
+	else if (value == DRAW_VALUE)
+		*score = 0;
+	else
+		return 0;
+
+	return 1;
+}
+
+
+// GENERATION
+
+/*
+ * Lists the tables in the order they have to be generated:
+ * by number of pieces, and then by number of pawns, as promotions
+ * lead to endings with fewer pawns.
+ */
+static void initTables(const int maxPieces) {
+	nTables = 0;
+
+	for (int pieces = 3; pieces <= maxPieces; ++pieces) {
+		for (int pawns = 0; pawns <= pieces - 2; ++pawns) {
+			for (int a = QUEEN; a >= PAWN; --a) {
+				if (pieces == 3) {
+					if ((a == PAWN) == pawns)
+						addTable(a, -1, -1);
+					continue;
+				}
+
+				for (int b = a; b >= PAWN; --b) {
+					if ((a == PAWN) + (b == PAWN) != pawns)
+						continue;
+
+					addTable(a, b, -1);
+					addTable(a, -1, b);
+				}
+			}
+		}
+	}
+}
+
+// Unmaps the table files loaded before
+static void unmapTables(void) {
+	for (int i = 0; i < nTables; ++i) {
+		if (tables[i].mapped)
+			munmap(tables[i].data, tables[i].size);
+	}
+}
+
+static void addTable(const int white1, const int white2, const int black) {
+	ASSERT(nTables < MAX_TABLES);
+
+	Table *table = &tables[nTables++];
+	int counts[2][PIECES] = {{ 0 }};
+	int n = 0;
+
+	*table = (Table){ .nPieces = 2 };
+
+	table->name[n++] = 'K';
+	table->extra[0] = WHITE * PIECES + white1;
+	++counts[WHITE][white1];
+	table->name[n++] = pieceLetters[white1];
+
+	if (white2 != -1) {
+		table->extra[1] = WHITE * PIECES + white2;
+		++counts[WHITE][white2];
+		table->name[n++] = pieceLetters[white2];
+	}
+
+	table->name[n++] = 'K';
+
+	if (black != -1) {
+		table->extra[1] = BLACK * PIECES + black;
+		++counts[BLACK][black];
+		table->name[n++] = pieceLetters[black];
+	}
+
+	table->name[n] = '\0';
+	table->nPieces = (n == 3) ? 3 : 4;
+	table->pawns = counts[WHITE][PAWN] + counts[BLACK][PAWN];
+	table->enPassant = counts[WHITE][PAWN] && counts[BLACK][PAWN];
+
+	int flipped[2][PIECES];
+	memcpy(flipped[0], counts[1], sizeof(counts[1]));
+	memcpy(flipped[1], counts[0], sizeof(counts[0]));
+
+	table->key = materialKey(counts);
+	table->flippedKey = materialKey(flipped);
+
+	table->size = (table->pawns ? 32 : 10) * 64 * 2;
+
+	for (int i = 2; i < table->nPieces; ++i)
+		table->size *= 64;
+}
+
+static void generateTable(Table *table, const int threads) {
+	pthread_t workers[threads];
+	Worker args[threads];
+
+	const uint64_t words = table->size / 64 + 1;
+
+	table->data = malloc(table->size);
+	memset(table->data, UNKNOWN_VALUE, table->size);
+
+	// Every position is visited on the first iteration
+	uint64_t *dirty = malloc(words * sizeof(uint64_t));
+	uint64_t *nextDirty = malloc(words * sizeof(uint64_t));
+
+	memset(dirty, 0xff, words * sizeof(uint64_t));
+
+	// Captures and promotions lead to tables that are already finished
+	int maxChildPly = 0;
+
+	for (Table *t = tables; t < table; ++t)
+		maxChildPly = max(maxChildPly, t->maxPly);
+
+	table->maxPly = 0;
+
+	/*
+	 * All the positions with a distance to mate lower than the ply
+	 * are known at the start of each iteration. Once there are no
+	 * positions left at the current distance, there can't be any further.
+	 */
+	for (int ply = 0; ply <= table->maxPly + 1 || ply <= maxChildPly + 2; ++ply) {
+		const uint64_t chunk = table->size / threads + 1;
+
+		// En passant captures aren't followed back, so every position is visited
+		memset(nextDirty, table->enPassant ? 0xff : 0, words * sizeof(uint64_t));
+
+		for (int i = 0; i < threads; ++i) {
+			args[i] = (Worker){
+				.table = table,
+				.dirty = dirty,
+				.nextDirty = nextDirty,
+				.start = i * chunk,
+				.end = min((i + 1) * chunk, table->size),
+				.ply = ply
+			};
+
+			pthread_create(&workers[i], NULL, generateRange, &args[i]);
+		}
+
+		for (int i = 0; i < threads; ++i) {
+			pthread_join(workers[i], NULL);
+			table->maxPly = max(table->maxPly, args[i].maxPly);
+		}
+
+		uint64_t *tmp = dirty;
+		dirty = nextDirty;
+		nextDirty = tmp;
+	}
+
+	free(dirty);
+	free(nextDirty);
+
+	// The positions that couldn't be resolved are draws
+	for (uint64_t i = 0; i < table->size; ++i) {
+		if (table->data[i] == UNKNOWN_VALUE)
+			table->data[i] = DRAW_VALUE;
+	}
+}
+
+static void *generateRange(void *args) {
+	Worker *worker = (Worker *) args;
+	Table *table = worker->table;
+
+	Board board;
+
+	for (uint64_t i = worker->start; i < worker->end; ++i) {
+		if (!isDirty(worker->dirty, i) || loadValue(&table->data[i]) != UNKNOWN_VALUE)
+			continue;
+
+		if (!indexToBoard(table, i, &board)) {
+			storeValue(&table->data[i], ILLEGAL_VALUE);
+			continue;
+		}
+
+		int pending = 0;
+		const int value = resolve(&board, worker->ply, &pending);
+
+		if (value != UNKNOWN_VALUE) {
+			storeValue(&table->data[i], value);
+			markPredecessors(table, &board, worker->nextDirty);
+
+			const int plies = isLoss(value) ? value - LOSS_VALUE : value;
+			worker->maxPly = max(worker->maxPly, plies);
+		} else if (pending) {
+			// A win through a capture or a promotion that might still be the fastest
+			setDirty(worker->nextDirty, i);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns the value of the position if it can be known from its children.
+ * Every unknown child mates in at least ply plies.
+ */
+static int resolve(Board *board, const int ply, int *pending) {
+	Move moves[MAX_MOVES];
+	const int nMoves = legalMoves(board, moves);
+
+	if (nMoves == 0)
+		return inCheck(board) ? LOSS_VALUE : DRAW_VALUE;
+
+	int bestWin = INT_MAX, worstLoss = 0;
+	int unknown = 0, draw = 0;
+
+	for (int i = 0; i < nMoves; ++i) {
+		History history;
+
+		makeMove(board, &moves[i], &history);
+		const int value = childValue(board, ply);
+		undoMove(board, &moves[i], &history);
+
+		if (isLoss(value))
+			bestWin = min(bestWin, value - LOSS_VALUE + 1);
+		else if (isWin(value))
+			worstLoss = max(worstLoss, value + 1);
+		else if (value == UNKNOWN_VALUE)
+			unknown = 1;
+		else
+			draw = 1;
+	}
+
+	// An unknown child can't lead to a faster win than ply + 1
+	if (bestWin != INT_MAX && (!unknown || bestWin <= ply + 1)) {
+		ASSERT(bestWin < LOSS_VALUE);
+		return bestWin;
+	}
+
+	if (unknown) {
+		*pending = bestWin != INT_MAX;
+		return UNKNOWN_VALUE;
+	}
+
+	if (draw)
+		return DRAW_VALUE;
+
+	ASSERT(worstLoss < UNKNOWN_VALUE - LOSS_VALUE);
+	return LOSS_VALUE + worstLoss;
+}
+
+/*
+ * Positions where en passant is possible aren't indexed,
+ * so they are resolved by looking one ply further.
+ */
+static int childValue(Board *board, const int ply) {
+	int pending;
+
+	if (board->enPassant && (pawnAttacksLookup[board->opponent][board->enPassant] & board->pieces[board->turn][PAWN]))
+		return resolve(board, ply, &pending);
+
+	return probeValue(board);
+}
+
+/*
+ * Marks the positions that could have led to this one by a quiet move.
+ * Some of them might be illegal, which is harmless.
+ */
+static void markPredecessors(const Table *table, const Board *board, uint64_t *dirty) {
+	static const uint64_t pawnRanks = 0x00ffffffffffff00;
+
+	const int color = board->opponent;
+
+	Board prev = *board;
+	prev.turn = color;
+	prev.opponent = board->turn;
+
+	for (int piece = PAWN; piece <= KING; ++piece) {
+		uint64_t bb = board->pieces[color][piece];
+
+		if (bb) do {
+			const int sqr = bitScanForward(bb);
+			uint64_t origins;
+
+			switch (piece) {
+			case PAWN: {
+				const int back = (color == WHITE) ? sqr - 8 : sqr + 8;
+				origins = bitmask[back] & board->empty & pawnRanks;
+
+				// Double push
+				if (origins && get_rank(sqr) == ((color == WHITE) ? 3 : 4))
+					origins |= bitmask[(color == WHITE) ? back - 8 : back + 8] & board->empty;
+
+				break;
+			}
+			case KNIGHT:
+				origins = knightLookup[sqr] & board->empty;
+				break;
+			case BISHOP:
+				origins = bishopAttacks(sqr, board->occupied) & board->empty;
+				break;
+			case ROOK:
+				origins = rookAttacks(sqr, board->occupied) & board->empty;
+				break;
+			case QUEEN:
+				origins = (bishopAttacks(sqr, board->occupied) | rookAttacks(sqr, board->occupied)) & board->empty;
+				break;
+			default:
+				origins = kingLookup[sqr] & board->empty;
+			}
+
+			if (origins) do {
+				const int from = bitScanForward(origins);
+
+				prev.pieces[color][piece] = board->pieces[color][piece] ^ bitmask[sqr] ^ bitmask[from];
+
+				if (piece == KING)
+					prev.kingIndex[color] = from;
+
+				setDirty(dirty, tableIndex(table, &prev, 0));
+			} while (unsetLSB(origins));
+
+			prev.pieces[color][piece] = board->pieces[color][piece];
+			prev.kingIndex[color] = board->kingIndex[color];
+		} while (unsetLSB(bb));
+	}
+}
+
+static int probeValue(const Board *board) {
+	if (popCount(board->occupied) == 2)
+		return DRAW_VALUE;
+
+	int flip;
+	const Table *table = findTable(board, &flip);
+
+	ASSERT(table != NULL && table->data != NULL);
+
+	return loadValue(&table->data[tableIndex(table, board, flip)]);
+}
+
+
+// INDEXING
+
+/*
+ * Finds the table for the board's material.
+ * The board has to be flipped when black is the strong side.
+ */
+static Table *findTable(const Board *board, int *flip) {
+	int counts[2][PIECES] = {{ 0 }};
+
+	for (int color = WHITE; color <= BLACK; ++color) {
+		for (int piece = PAWN; piece < KING; ++piece)
+			counts[color][piece] = popCount(board->pieces[color][piece]);
+	}
+
+	const uint64_t key = materialKey(counts);
+
+	for (int i = 0; i < nTables; ++i) {
+		if (key == tables[i].key) {
+			*flip = 0;
+			return &tables[i];
+		}
+
+		if (key == tables[i].flippedKey) {
+			*flip = 1;
+			return &tables[i];
+		}
+	}
+
+	return NULL;
+}
+
+static uint64_t tableIndex(const Table *table, const Board *board, const int flip) {
+	const int flipSqr = flip ? 56 : 0;
+
+	int sqrs[4];
+
+	sqrs[0] = board->kingIndex[WHITE ^ flip] ^ flipSqr;
+	sqrs[1] = board->kingIndex[BLACK ^ flip] ^ flipSqr;
+
+	for (int i = 2; i < table->nPieces; ++i) {
+		const int color = table->extra[i - 2] / PIECES ^ flip;
+		const uint64_t bb = board->pieces[color][table->extra[i - 2] % PIECES];
+
+		const int second = i == 3 && table->extra[0] == table->extra[1];
+		sqrs[i] = (second ? bitScanReverse(bb) : bitScanForward(bb)) ^ flipSqr;
+	}
+
+	// Mirrors the board to place the white king on the left half
+	if (get_file(sqrs[0]) > 3) {
+		for (int i = 0; i < table->nPieces; ++i)
+			sqrs[i] ^= 7;
+	}
+
+	if (!table->pawns) {
+		// And then on the lower half
+		if (get_rank(sqrs[0]) > 3) {
+			for (int i = 0; i < table->nPieces; ++i)
+				sqrs[i] ^= 56;
+		}
+
+		const int diagonal = get_rank(sqrs[0]) == get_file(sqrs[0]);
+
+		// And below the a1-h8 diagonal
+		if (diagonal || get_rank(sqrs[0]) > get_file(sqrs[0])) {
+			int flipped[4];
+
+			for (int i = 0; i < table->nPieces; ++i)
+				flipped[i] = 8 * get_file(sqrs[i]) + get_rank(sqrs[i]);
+
+			// With the king on the diagonal both are valid, so the lowest index is taken
+			if (!diagonal)
+				return squaresIndex(table, flipped, board->turn ^ flip);
+
+			return min64(squaresIndex(table, sqrs, board->turn ^ flip), squaresIndex(table, flipped, board->turn ^ flip));
+		}
+	}
+
+	return squaresIndex(table, sqrs, board->turn ^ flip);
+}
+
+static uint64_t squaresIndex(const Table *table, int *sqrs, const int turn) {
+	int pieces[4];
+	memcpy(pieces, sqrs, table->nPieces * sizeof(int));
+
+	// Two identical pieces are sorted
+	if (table->nPieces == 4 && table->extra[0] == table->extra[1] && pieces[2] > pieces[3]) {
+		pieces[2] = sqrs[3];
+		pieces[3] = sqrs[2];
+	}
+
+	uint64_t index = table->pawns ? 4 * get_rank(pieces[0]) + get_file(pieces[0]) : triangle[pieces[0]];
+
+	for (int i = 1; i < table->nPieces; ++i)
+		index = 64 * index + pieces[i];
+
+	return 2 * index + turn;
+}
+
+/*
+ * Sets up the position for an index. Returns 0 if it's illegal
+ * or if it isn't the index that would be used for the position.
+ */
+static int indexToBoard(const Table *table, const uint64_t tableIdx, Board *board) {
+	int sqrs[4];
+
+	uint64_t index = tableIdx;
+	const int turn = index & 1;
+	index >>= 1;
+
+	for (int i = table->nPieces - 1; i >= 1; --i) {
+		sqrs[i] = index % 64;
+		index /= 64;
+	}
+
+	sqrs[0] = table->pawns ? (int) (8 * (index / 4) + index % 4) : triangleSqrs[index];
+
+	*board = blankBoard();
+
+	for (int i = 0; i < table->nPieces; ++i) {
+		const int color = (i < 2) ? i : table->extra[i - 2] / PIECES;
+		const int piece = (i < 2) ? KING : table->extra[i - 2] % PIECES;
+
+		if (board->occupied & bitmask[sqrs[i]])
+			return 0;
+
+		if (piece == PAWN && (bitmask[sqrs[i]] & 0xff000000000000ff))
+			return 0;
+
+		board->pieces[color][piece] |= bitmask[sqrs[i]];
+		board->occupied |= bitmask[sqrs[i]];
+	}
+
+	board->kingIndex[WHITE] = sqrs[0];
+	board->kingIndex[BLACK] = sqrs[1];
+
+	board->turn = turn;
+	board->opponent = 1 ^ turn;
+	board->castling = 0;
+	board->enPassant = 0;
+	board->fiftyMoves = 0;
+	board->ply = 0;
+
+	updateBoard(board);
+
+	if (kingLookup[sqrs[0]] & bitmask[sqrs[1]])
+		return 0;
+
+	// Symmetrical positions are only stored once
+	if (tableIndex(table, board, 0) != tableIdx)
+		return 0;
+
+	// The side that just moved can't be in check
+	return !kingAttacked(board, board->opponent);
+}
+
+static uint64_t materialKey(int counts[2][PIECES]) {
+	uint64_t key = 0;
+
+	for (int color = WHITE; color <= BLACK; ++color) {
+		for (int piece = PAWN; piece < KING; ++piece)
+			key |= (uint64_t) counts[color][piece] << (4 * (PIECES * color + piece));
+	}
+
+	return key;
+}
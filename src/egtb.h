@@ -0,0 +1,18 @@
+#ifndef SRC_EGTB_H_
+#define SRC_EGTB_H_
+
+#include "board.h"
+#include "eval.h"
+
+#define EGTB_PATH "egtb"
+#define EGTB_PIECES 4
+
+// Score of a won table position, minus the plies to mate
+#define TB_WIN (MAX_SCORE / 2)
+
+void generateEGTB(const char *path, const int maxPieces, const int threads);
+int loadEGTB(const char *path);
+
+int probeEGTB(const Board *board, int *score);
+
+#endif /* SRC_EGTB_H_ */
@@ -1,6 +1,7 @@
 #include "board.h"
 #include "draw.h"
 #include "eval.h"
+#include "kpk.h"
 
 static void countPieces(const Board *board, Count *wCount, Count *bCount);
 
@@ -11,8 +12,38 @@ static int pieceSquareTables(const Board *board, const int phase, const int colo
 
 static int materialCount(const Count *count);
 
+static int mobility(const Board *board, const AttackInfo *info, const int phase, const int color);
+static int kingSafety(const Board *board, const AttackInfo *info, const int phase, const int color);
+
+static int evalSpecialEndgame(const Board *board, const Count *wCount, const Count *bCount, int *score);
+static int evalMate(const Board *board, const Count *count, const int strong);
+static int evalKBNK(const Board *board, const int strong);
+
 int pieceValues[6] = {100, 325, 330, 550, 900, 10000};
 
+int pst[PHASES][6][64] = {
+{
+	{ 0, 0, 0, 0, 0, 0, 0, 0, -1, -7, -11, -35, -13, 5, 3, -5, 1, 1, -6, -19, -6, -7, -4, 10, 1, 14, 8, 4, 5, 4, 10, 7, 9, 30, 23, 31, 31, 23, 17, 11, 21, 54, 72, 56, 77, 95, 71, 11, 118, 121, 173, 168, 107, 82, -16, 22, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ -99, -30, -66, -64, -29, -19, -61, -81, -56, -31, -28, -1, -7, -20, -42, -11, -38, -16, 0, 14, 8, 3, 3, -42, -14, 0, 2, 3, 19, 12, 33, -7, -14, -4, 25, 33, 10, 33, 14, 43, -22, 18, 60, 64, 124, 143, 55, 6, -34, 24, 54, 74, 60, 122, 2, 29, -60, 0, 0, 0, 0, 0, 0, 0 },
+	{ -7, 12, -8, -37, -31, -8, -45, -67, 15, 5, 13, -10, 1, 2, 0, 15, 5, 12, 14, 13, 10, -1, 3, 4, 1, 5, 23, 32, 21, 8, 17, 4, -1, 16, 29, 27, 37, 27, 17, 4, 7, 27, 20, 56, 91, 108, 53, 44, -24, -23, 30, 58, 65, 61, 69, 11, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ -2, -1, 3, 1, 2, 1, 4, -8, -26, -6, 2, -2, 2, -10, -1, -29, -16, 0, 3, -3, 8, -1, 12, 3, -9, -5, 8, 14, 18, -17, 13, -13, 19, 33, 46, 57, 53, 39, 53, 16, 24, 83, 54, 75, 134, 144, 85, 75, 46, 33, 64, 62, 91, 89, 70, 104, 84, 0, 0, 37, 124, 0, 0, 153 },
+	{ 1, -10, -11, 3, -15, -51, -83, -13, -7, 3, 2, 5, -1, -10, -7, -2, -11, 0, 12, 2, 8, 11, 7, -6, -9, 5, 7, 9, 18, 17, 26, 4, -6, 0, 15, 25, 32, 9, 26, 12, -16, 10, 13, 25, 37, 30, 15, 26, 1, 11, 35, 0, 16, 55, 39, 57, -13, 6, -42, 0, 29, 0, 0, 102 },
+	{ 0, 0, 0, -9, 0, -9, 25, 0, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9 }
+},
+{
+	{ 0, 0, 0, 0, 0, 0, 0, 0, -17, -17, -17, -17, -17, -17, -17, -17, -11, -11, -11, -11, -11, -11, -11, -11, -7, -7, -7, -7, -7, -7, -7, -7, 16, 16, 16, 16, 16, 16, 16, 16, 55, 55, 55, 55, 55, 55, 55, 55, 82, 82, 82, 82, 82, 82, 82, 82, 0, 0, 0, 0, 0, 0, 0, 0 },
+	{ -99, -99, -94, -88, -88, -94, -99, -99, -81, -62, -49, -43, -43, -49, -62, -81, -46, -27, -15, -9, -9, -15, -27, -46, -22, -3, 10, 16, 16, 10, -3, -22, -7, 12, 25, 31, 31, 25, 12, -7, -2, 17, 30, 36, 36, 30, 17, -2, -7, 12, 25, 31, 31, 25, 12, -7, -21, -3, 10, 16, 16, 10, -3, -21 },
+	{ -27, -21, -17, -15, -15, -17, -21, -27, -10, -4, 0, 2, 2, 0, -4, -10, 2, 8, 12, 14, 14, 12, 8, 2, 11, 17, 21, 23, 23, 21, 17, 11, 14, 20, 24, 26, 26, 24, 20, 14, 13, 19, 23, 25, 25, 23, 19, 13, 8, 14, 18, 20, 20, 18, 14, 8, -2, 4, 8, 10, 10, 8, 4, -2 },
+	{ -32, -31, -30, -29, -29, -30, -31, -32, -27, -25, -24, -24, -24, -24, -25, -27, -15, -13, -12, -12, -12, -12, -13, -15, 1, 2, 3, 4, 4, 3, 2, 1, 15, 17, 18, 18, 18, 18, 17, 15, 25, 27, 28, 28, 28, 28, 27, 25, 27, 28, 29, 30, 30, 29, 28, 27, 16, 17, 18, 19, 19, 18, 17, 16 },
+	{ -61, -55, -52, -50, -50, -52, -55, -61, -31, -26, -22, -21, -21, -22, -26, -31, -8, -3, 1, 3, 3, 1, -3, -8, 9, 14, 17, 19, 19, 17, 14, 9, 19, 24, 28, 30, 30, 28, 24, 19, 23, 28, 32, 34, 34, 32, 28, 23, 21, 26, 30, 31, 31, 30, 26, 21, 12, 17, 21, 23, 23, 21, 17, 12 },
+	{ -34, -30, -28, -27, -27, -28, -30, -34, -17, -13, -11, -10, -10, -11, -13, -17, -2, 2, 4, 5, 5, 4, 2, -2, 11, 15, 17, 18, 18, 17, 15, 11, 22, 26, 28, 29, 29, 28, 26, 22, 31, 34, 37, 38, 38, 37, 34, 31, 38, 41, 44, 45, 45, 44, 41, 38, 42, 46, 48, 50, 50, 48, 46, 42 }
+}};
+
+int mobilityWeights[PHASES][6] = {
+	{0, 4, 5, 2, 1, 0},
+	{0, 4, 5, 4, 2, 0}
+};
+
 /*
  * Evaluates a position that has no possible moves.
  */
@@ -25,16 +56,39 @@ int finalEval(const Board *board, const int depth) {
  * Scores are positive for the side about to play.
  */
 int eval(const Board *board) {
+	AttackInfo info;
+
+	fillAttackInfo(board, &info);
+
+	return evalWithAttacks(board, &info);
+}
+
+/*
+ * Evaluates the position reusing the attacks already computed for the node.
+ */
+int evalWithAttacks(const Board *board, const AttackInfo *info) {
 	Count wCount, bCount;
 
+	int kpkScore;
+
+	if (evalKPK(board, &kpkScore))
+		return kpkScore;
+
 	countPieces(board, &wCount, &bCount);
 
+	int score;
+
+	if (evalSpecialEndgame(board, &wCount, &bCount, &score))
+		return score;
+
 	const int phase = getPhase(&wCount, &bCount);
 
-	int score = 0;
+	score = 0;
 
 	score += materialCount(&wCount) - materialCount(&bCount);
 	score += pieceSquareTables(board, phase, WHITE) - pieceSquareTables(board, phase, BLACK);
+	score += mobility(board, info, phase, WHITE) - mobility(board, info, phase, BLACK);
+	score += kingSafety(board, info, phase, WHITE) - kingSafety(board, info, phase, BLACK);
 
 	if (board->turn == BLACK)
 		score = -score;
@@ -42,6 +96,96 @@ int eval(const Board *board) {
 	return score;
 }
 
+/*
+ * Scores king and pawn vs king positions with the bitbase.
+ * Returns 0 if the position isn't one of them.
+ * Won positions get a bonus for the pawn's rank, so that the search pushes it,
+ * but always less than a queen, so that promoting is preferred.
+ */
+int evalKPK(const Board *board, int *score) {
+	static const int kpkWin = 500;
+
+	if (popCount(board->occupied) != 3 || !(board->pieces[WHITE][PAWN] | board->pieces[BLACK][PAWN]))
+		return 0;
+
+	const int strong = board->pieces[WHITE][PAWN] ? WHITE : BLACK;
+
+	*score = 0;
+
+	if (probeKPK(board, strong)) {
+		const int pawn = bitScanForward(board->pieces[strong][PAWN]);
+		const int rank = (strong == WHITE) ? get_rank(pawn) : 7 - get_rank(pawn);
+
+		*score = kpkWin + 20 * rank;
+
+		if (board->turn != strong)
+			*score = -*score;
+	}
+
+	return 1;
+}
+
+/*
+ * Scores pawnless endings against a lone king with dedicated functions.
+ * Returns 0 if the material configuration doesn't have one.
+ * Forced wins get a large bonus so that the search never trades into
+ * anything else, while the weakest side can't do better than a draw.
+ */
+static int evalSpecialEndgame(const Board *board, const Count *wCount, const Count *bCount, int *score) {
+	if (wCount->nPawns || bCount->nPawns)
+		return 0;
+
+	if (wCount->nTotal > 1 && bCount->nTotal > 1)
+		return 0;
+
+	const int strong = (wCount->nTotal > 1) ? WHITE : BLACK;
+	const Count *count = (strong == WHITE) ? wCount : bCount;
+
+	if (count->nRooks || count->nQueens)
+		*score = evalMate(board, count, strong);
+	else if (count->nBishops == 1 && count->nKnights == 1 && count->nTotal == 3)
+		*score = evalKBNK(board, strong);
+	else if (count->nBishops >= 2 && (board->pieces[strong][BISHOP] & lightSquares) &&
+			(board->pieces[strong][BISHOP] & darkSquares))
+		*score = evalMate(board, count, strong);
+	else if (count->nBishops + count->nKnights <= 2 && count->nBishops <= 1)
+		*score = 0;
+	else
+		return 0;
+
+	if (board->turn != strong)
+		*score = -*score;
+
+	return 1;
+}
+
+/*
+ * Mating the lone king only requires pushing it to the edge
+ * and bringing our own king closer.
+ */
+static int evalMate(const Board *board, const Count *count, const int strong) {
+	const int winning = board->kingIndex[strong];
+	const int losing = board->kingIndex[1 ^ strong];
+
+	return KNOWN_WIN + materialCount(count) +
+			20 * centerDistance(losing) + 10 * (7 - kingDistance(winning, losing));
+}
+
+/*
+ * The bishop and knight can only mate on a corner of the bishop's color,
+ * so the lone king has to be driven there.
+ */
+static int evalKBNK(const Board *board, const int strong) {
+	const int losing = board->kingIndex[1 ^ strong];
+	const int file = get_file(losing), rank = get_rank(losing);
+
+	const int corner = (board->pieces[strong][BISHOP] & darkSquares)
+			? min(file + rank, 14 - file - rank)
+			: min(7 - file + rank, 7 + file - rank);
+
+	return evalMate(board, &(Count) {.nBishops = 1, .nKnights = 1}, strong) + 40 * (7 - corner);
+}
+
 /*
  * Two structures are generated to save recomputing pop counts later on.
  */
@@ -82,12 +226,16 @@ static int getPhase(const Count *wCount, const Count *bCount) {
     return (phase * 256 + (totalPhase / 2)) / totalPhase;
 }
 
-int isEndgame(const Board *board) {
+int gamePhase(const Board *board) {
 	Count wCount, bCount;
 
 	countPieces(board, &wCount, &bCount);
 
-	return getPhase(&wCount, &bCount) > 150;
+	return getPhase(&wCount, &bCount);
+}
+
+int isEndgame(const Board *board) {
+	return gamePhase(board) > 150;
 }
 
 /*
@@ -112,24 +260,6 @@ static int materialCount(const Count *count) {
  * It also depends on the stage of the game: opening/middle-game or endgame.
  */
 static int pieceSquareTables(const Board *board, const int phase, const int color) {
-	static const int pst[2][6][64] = {
-	{
-		{ 0, 0, 0, 0, 0, 0, 0, 0, -1, -7, -11, -35, -13, 5, 3, -5, 1, 1, -6, -19, -6, -7, -4, 10, 1, 14, 8, 4, 5, 4, 10, 7, 9, 30, 23, 31, 31, 23, 17, 11, 21, 54, 72, 56, 77, 95, 71, 11, 118, 121, 173, 168, 107, 82, -16, 22, 0, 0, 0, 0, 0, 0, 0, 0 },
-		{ -99, -30, -66, -64, -29, -19, -61, -81, -56, -31, -28, -1, -7, -20, -42, -11, -38, -16, 0, 14, 8, 3, 3, -42, -14, 0, 2, 3, 19, 12, 33, -7, -14, -4, 25, 33, 10, 33, 14, 43, -22, 18, 60, 64, 124, 143, 55, 6, -34, 24, 54, 74, 60, 122, 2, 29, -60, 0, 0, 0, 0, 0, 0, 0 },
-		{ -7, 12, -8, -37, -31, -8, -45, -67, 15, 5, 13, -10, 1, 2, 0, 15, 5, 12, 14, 13, 10, -1, 3, 4, 1, 5, 23, 32, 21, 8, 17, 4, -1, 16, 29, 27, 37, 27, 17, 4, 7, 27, 20, 56, 91, 108, 53, 44, -24, -23, 30, 58, 65, 61, 69, 11, 0, 0, 0, 0, 0, 0, 0, 0 },
-		{ -2, -1, 3, 1, 2, 1, 4, -8, -26, -6, 2, -2, 2, -10, -1, -29, -16, 0, 3, -3, 8, -1, 12, 3, -9, -5, 8, 14, 18, -17, 13, -13, 19, 33, 46, 57, 53, 39, 53, 16, 24, 83, 54, 75, 134, 144, 85, 75, 46, 33, 64, 62, 91, 89, 70, 104, 84, 0, 0, 37, 124, 0, 0, 153 },
-		{ 1, -10, -11, 3, -15, -51, -83, -13, -7, 3, 2, 5, -1, -10, -7, -2, -11, 0, 12, 2, 8, 11, 7, -6, -9, 5, 7, 9, 18, 17, 26, 4, -6, 0, 15, 25, 32, 9, 26, 12, -16, 10, 13, 25, 37, 30, 15, 26, 1, 11, 35, 0, 16, 55, 39, 57, -13, 6, -42, 0, 29, 0, 0, 102 },
-		{ 0, 0, 0, -9, 0, -9, 25, 0, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9, -9 }
-	},
-	{
-		{ 0, 0, 0, 0, 0, 0, 0, 0, -17, -17, -17, -17, -17, -17, -17, -17, -11, -11, -11, -11, -11, -11, -11, -11, -7, -7, -7, -7, -7, -7, -7, -7, 16, 16, 16, 16, 16, 16, 16, 16, 55, 55, 55, 55, 55, 55, 55, 55, 82, 82, 82, 82, 82, 82, 82, 82, 0, 0, 0, 0, 0, 0, 0, 0 },
-		{ -99, -99, -94, -88, -88, -94, -99, -99, -81, -62, -49, -43, -43, -49, -62, -81, -46, -27, -15, -9, -9, -15, -27, -46, -22, -3, 10, 16, 16, 10, -3, -22, -7, 12, 25, 31, 31, 25, 12, -7, -2, 17, 30, 36, 36, 30, 17, -2, -7, 12, 25, 31, 31, 25, 12, -7, -21, -3, 10, 16, 16, 10, -3, -21 },
-		{ -27, -21, -17, -15, -15, -17, -21, -27, -10, -4, 0, 2, 2, 0, -4, -10, 2, 8, 12, 14, 14, 12, 8, 2, 11, 17, 21, 23, 23, 21, 17, 11, 14, 20, 24, 26, 26, 24, 20, 14, 13, 19, 23, 25, 25, 23, 19, 13, 8, 14, 18, 20, 20, 18, 14, 8, -2, 4, 8, 10, 10, 8, 4, -2 },
-		{ -32, -31, -30, -29, -29, -30, -31, -32, -27, -25, -24, -24, -24, -24, -25, -27, -15, -13, -12, -12, -12, -12, -13, -15, 1, 2, 3, 4, 4, 3, 2, 1, 15, 17, 18, 18, 18, 18, 17, 15, 25, 27, 28, 28, 28, 28, 27, 25, 27, 28, 29, 30, 30, 29, 28, 27, 16, 17, 18, 19, 19, 18, 17, 16 },
-		{ -61, -55, -52, -50, -50, -52, -55, -61, -31, -26, -22, -21, -21, -22, -26, -31, -8, -3, 1, 3, 3, 1, -3, -8, 9, 14, 17, 19, 19, 17, 14, 9, 19, 24, 28, 30, 30, 28, 24, 19, 23, 28, 32, 34, 34, 32, 28, 23, 21, 26, 30, 31, 31, 30, 26, 21, 12, 17, 21, 23, 23, 21, 17, 12 },
-		{ -34, -30, -28, -27, -27, -28, -30, -34, -17, -13, -11, -10, -10, -11, -13, -17, -2, 2, 4, 5, 5, 4, 2, -2, 11, 15, 17, 18, 18, 17, 15, 11, 22, 26, 28, 29, 29, 28, 26, 22, 31, 34, 37, 38, 38, 37, 34, 31, 38, 41, 44, 45, 45, 44, 41, 38, 42, 46, 48, 50, 50, 48, 46, 42 }
-	}};
-
 	int (*indexFunc)(uint64_t) = (color == WHITE) ? bitScanForward : mirrorLSB;
 
 	int opening = 0, endgame = 0;
@@ -146,3 +276,56 @@ static int pieceSquareTables(const Board *board, const int phase, const int colo
 
 	return taperedEval(phase, opening, endgame);
 }
+
+/*
+ * Gives points for every square a piece can safely move to.
+ * Squares attacked by enemy pawns or occupied by friendly pieces don't count.
+ */
+static int mobility(const Board *board, const AttackInfo *info, const int phase, const int color) {
+	const uint64_t safe = ~board->players[color] & ~info->attacks[1 ^ color][PAWN];
+
+	int opening = 0, endgame = 0;
+
+	for (int piece = KNIGHT; piece <= QUEEN; ++piece) {
+		uint64_t bb = board->pieces[color][piece];
+
+		if (bb) do {
+			const int moves = popCount(info->pieceAttacks[bitScanForward(bb)] & safe);
+			opening += mobilityWeights[OPENING][piece] * moves;
+			endgame += mobilityWeights[ENDGAME][piece] * moves;
+		} while (unsetLSB(bb));
+	}
+
+	return taperedEval(phase, opening, endgame);
+}
+
+/*
+ * Penalizes the enemy pieces attacking the squares around the king.
+ * The penalty grows with the number of attackers and fades in the endgame.
+ */
+static int kingSafety(const Board *board, const AttackInfo *info, const int phase, const int color) {
+	static const int attackWeights[6] = {0, 2, 2, 3, 5, 0};
+	static const int attackScale[8] = {0, 0, 50, 75, 88, 94, 97, 99};
+
+	const int kingIndex = board->kingIndex[color];
+	const uint64_t kingZone = kingLookup[kingIndex] | bitmask[kingIndex];
+
+	int attackers = 0, weight = 0;
+
+	for (int piece = KNIGHT; piece <= QUEEN; ++piece) {
+		uint64_t bb = board->pieces[1 ^ color][piece];
+
+		if (bb) do {
+			const uint64_t hits = info->pieceAttacks[bitScanForward(bb)] & kingZone;
+
+			if (hits) {
+				++attackers;
+				weight += attackWeights[piece] * popCount(hits);
+			}
+		} while (unsetLSB(bb));
+	}
+
+	const int penalty = 4 * weight * attackScale[min(attackers, 7)] / 100;
+
+	return taperedEval(phase, -penalty, 0);
+}
@@ -3,6 +3,7 @@
 
 
 #define MAX_SCORE 10000
+#define KNOWN_WIN 2000
 #define PHASES 2
 
 enum {OPENING, ENDGAME};
@@ -19,11 +20,17 @@ typedef struct {
 
 
 extern int pieceValues[6];
+extern int pst[PHASES][6][64];
+extern int mobilityWeights[PHASES][6];
 
 
 int finalEval(const Board *board, const int depth);
 int eval(const Board *board);
+int evalWithAttacks(const Board *board, const AttackInfo *info);
 
+int evalKPK(const Board *board, int *score);
+
+int gamePhase(const Board *board);
 int isEndgame(const Board *board);
 
 
@@ -378,6 +378,11 @@ void updateNullMoveKey(Board *board) {
 	board->key ^= randomKeys[TURN_OFFSET];
 }
 
+// Difference between the keys of two positions that differ by a non-capturing piece move
+uint64_t moveKey(const int color, const int piece, const int from, const int to) {
+	return randomKeys[getOffset(color, piece, from)] ^ randomKeys[getOffset(color, piece, to)] ^ randomKeys[TURN_OFFSET];
+}
+
 /*
  * Saves all the separate elements into a position.
  * Only the move is actually compressed.
@@ -451,43 +456,6 @@ Move decompressMove(const Board *board, const MoveCompressed *moveComp) {
 }
 
 
-// Finds the PV line from the TT. 
-// Due to collisions, it sometimes can be incomplete.
-int probePV(Board board, Move *pv) {
-
-   int n = 0;
-
-   while (1) {
-		const int index = board.key % settings.tt_entries;
-
-		// There's been a collision
-		if (board.key != tt[index].key)
-			break;
-
-		const Move move = decompressMove(&board, &tt[index].move);
-
-		if (!isLegalMove(&board, &move))
-			break;
-
-		ASSERT(move.to != move.from);
-
-		// Avoids getting into an infinite loop
-		for (int i = 0; i < n; ++i) {
-			if (compareMoves(&pv[i], &move))
-				return n;
-		}
-
-      pv[n++] = move;
-
-		History history;
-		makeMove(&board, &move, &history);
-		updateBoardKey(&board, &move, &history);
-	}
-
-	return n;
-}
-
-
 // Returns the offset for a piece.
 static inline int getOffset(const int color, const int piece, const int sqr) {
 	static const int kindOfPiece[2][PIECES] = {{1,3,5,7,9,11},{0,2,4,6,8,10}};
@@ -43,11 +43,11 @@ uint64_t zobristKey(const Board *board);
 
 void updateBoardKey(Board *board, const Move *move, const History *history);
 void updateNullMoveKey(Board *board);
+uint64_t moveKey(const int color, const int piece, const int from, const int to);
 
 Entry compressEntry(const uint64_t key, const Move *move, const int score, const int depth, const int flag);
 Move decompressMove(const Board *board, const MoveCompressed *moveComp);
 
-int probePV(Board board, Move *pv);
 
 
 #endif /* SRC_HASHTABLES_H_ */
@@ -0,0 +1,184 @@
+#include <string.h>
+
+#include "board.h"
+#include "pawns.h"
+#include "kpk.h"
+
+/*
+ * King and pawn vs king bitbase.
+ *
+ * Positions are normalized so that the strong side is white and the pawn
+ * is on files a-d. That leaves 24 pawn squares, 64 squares for each king
+ * and the side to move: 196608 positions, stored as one bit each (24 KB).
+ * A set bit means white wins, an unset bit means the position is drawn.
+ *
+ * The bitbase is generated at startup by retrograde analysis. Each position
+ * is first classified when its result is obvious (promotion, stalemate or
+ * the pawn being captured) and the rest are resolved by iterating over
+ * the positions until no more can be classified.
+ */
+
+#define KPK_SIZE (2 * 24 * 64 * 64)
+
+enum {INVALID = 0, UNKNOWN = 1, DRAW = 2, WIN = 4};
+
+static uint32_t bitbase[KPK_SIZE / 32];
+
+static int kpkIndex(const int turn, const int bKing, const int wKing, const int pawn);
+
+static int initPosition(const int index);
+static int classify(const uint8_t *db, const int index);
+
+static inline int distance(const int a, const int b) {
+	return max(abs(get_file(a) - get_file(b)), abs(get_rank(a) - get_rank(b)));
+}
+
+
+void initKPK(void) {
+	static uint8_t db[KPK_SIZE];
+
+	for (int i = 0; i < KPK_SIZE; ++i)
+		db[i] = initPosition(i);
+
+	// Every pass resolves the positions whose successors are already known
+	int changed;
+
+	do {
+		changed = 0;
+
+		for (int i = 0; i < KPK_SIZE; ++i) {
+			if (db[i] == UNKNOWN && (db[i] = classify(db, i)) != UNKNOWN)
+				changed = 1;
+		}
+	} while (changed);
+
+	memset(bitbase, 0, sizeof(bitbase));
+
+	for (int i = 0; i < KPK_SIZE; ++i) {
+		if (db[i] == WIN)
+			bitbase[i / 32] |= 1U << (i % 32);
+	}
+}
+
+/*
+ * Returns 1 if the side with the pawn wins, 0 if it's a draw.
+ * It's only valid for positions with two kings and a single pawn.
+ */
+int probeKPK(const Board *board, const int strong) {
+	ASSERT(popCount(board->occupied) == 3 && board->pieces[strong][PAWN]);
+
+	int wKing = board->kingIndex[strong];
+	int bKing = board->kingIndex[1 ^ strong];
+	int pawn  = bitScanForward(board->pieces[strong][PAWN]);
+	int turn  = (board->turn == strong) ? WHITE : BLACK;
+
+	// The board is flipped vertically so that the pawn is white
+	if (strong == BLACK) {
+		wKing ^= 56;
+		bKing ^= 56;
+		pawn  ^= 56;
+	}
+
+	// And mirrored horizontally so that the pawn is on files a-d
+	if (get_file(pawn) >= 4) {
+		wKing ^= 7;
+		bKing ^= 7;
+		pawn  ^= 7;
+	}
+
+	const int index = kpkIndex(turn, bKing, wKing, pawn);
+
+	return (bitbase[index / 32] >> (index % 32)) & 1;
+}
+
+
+// AUX
+
+/*
+ * Bits  0-5:  white king
+ * Bits  6-11: black king
+ * Bit  12:    side to move
+ * Bits 13-14: pawn file (a-d)
+ * Bits 15-17: pawn rank (6 - rank, from 0 to 5)
+ */
+static int kpkIndex(const int turn, const int bKing, const int wKing, const int pawn) {
+	return wKing | (bKing << 6) | (turn << 12) | (get_file(pawn) << 13) | ((6 - get_rank(pawn)) << 15);
+}
+
+static int initPosition(const int index) {
+	const int wKing = index & 0x3f;
+	const int bKing = (index >> 6) & 0x3f;
+	const int turn  = (index >> 12) & 1;
+	const int pawn  = 8 * (6 - (index >> 15)) + ((index >> 13) & 3);
+
+	// Kings next to each other, pieces on the same square or black in check with white to move
+	if (distance(wKing, bKing) <= 1 || wKing == pawn || bKing == pawn ||
+		(turn == WHITE && (pawnAttacksLookup[WHITE][pawn] & bitmask[bKing])))
+		return INVALID;
+
+	// The pawn can promote safely
+	if (turn == WHITE && get_rank(pawn) == 6 && wKing != pawn + 8 && bKing != pawn + 8 &&
+		(distance(bKing, pawn + 8) > 1 || distance(wKing, pawn + 8) == 1))
+		return WIN;
+
+	if (turn == BLACK) {
+		const uint64_t whiteAttacks = kingLookup[wKing] | pawnAttacksLookup[WHITE][pawn];
+
+		// Stalemate
+		if ((kingLookup[bKing] & ~whiteAttacks) == 0)
+			return DRAW;
+
+		// The pawn can be captured
+		if ((kingLookup[bKing] & ~kingLookup[wKing]) & bitmask[pawn])
+			return DRAW;
+	}
+
+	return UNKNOWN;
+}
+
+/*
+ * White wins if any of its moves leads to a win, while it's enough
+ * for black to have a single move leading to a draw.
+ * Illegal successors are INVALID and don't add anything to the result.
+ */
+static int classify(const uint8_t *db, const int index) {
+	const int wKing = index & 0x3f;
+	const int bKing = (index >> 6) & 0x3f;
+	const int turn  = (index >> 12) & 1;
+	const int pawn  = 8 * (6 - (index >> 15)) + ((index >> 13) & 3);
+
+	const int good = (turn == WHITE) ? WIN : DRAW;
+	const int bad  = (turn == WHITE) ? DRAW : WIN;
+
+	int result = INVALID;
+
+	if (turn == WHITE) {
+		uint64_t bb = kingLookup[wKing];
+
+		if (bb) do
+			result |= db[kpkIndex(BLACK, bKing, bitScanForward(bb), pawn)];
+		while (unsetLSB(bb));
+
+		// Single push, which leads to an invalid index if the square is blocked
+		if (get_rank(pawn) < 6)
+			result |= db[kpkIndex(BLACK, bKing, wKing, pawn + 8)];
+
+		// Double push
+		if (get_rank(pawn) == 1 && pawn + 8 != wKing && pawn + 8 != bKing)
+			result |= db[kpkIndex(BLACK, bKing, wKing, pawn + 16)];
+	} else {
+		uint64_t bb = kingLookup[bKing];
+
+		if (bb) do
+			result |= db[kpkIndex(WHITE, bitScanForward(bb), wKing, pawn)];
+		while (unsetLSB(bb));
+	}
+
+	if (result & good)
+		return good;
+
+	if (result & UNKNOWN)
+		return UNKNOWN;
+
+	return bad;
+}
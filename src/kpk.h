@@ -0,0 +1,10 @@
+#ifndef SRC_KPK_H_
+#define SRC_KPK_H_
+
+#include "board.h"
+
+void initKPK(void);
+
+int probeKPK(const Board *board, const int strong);
+
+#endif /* SRC_KPK_H_ */
@@ -7,6 +7,11 @@
 #include "magic.h"
 #include "draw.h"
 #include "hashtables.h"
+#include "kpk.h"
+#include "egtb.h"
+#include "tune.h"
+#include "search.h"
+#include "numa.h"
 
 #define INITIAL "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"
 
@@ -20,9 +25,16 @@ Settings settings = (Settings){ 0 };
 
 int main(void) {
 
+	// Before the TT is allocated, so that its pages are placed on the node of the search
+	initNuma();
+
 	initTT(DEF_TT_SIZE);
 	initMagics();
 	initInBetween();
+	initCuckoo();
+	initReductions();
+	initKPK();
+	loadEGTB(EGTB_PATH);
 
 	listen();
 
@@ -92,14 +104,26 @@ static void listen(void) {
 			testDraw();
 		else if (strncmp(msg, "test see", 8) == 0)
 			testSee();
-		else if (strncmp(msg, "quit", 4) == 0)
+		else if (strncmp(msg, "test kpk", 8) == 0)
+			testKPK();
+		else if (strncmp(msg, "egtb", 4) == 0) {
+			const int threads = max(1, atoi(msg + 5));
+			generateEGTB(EGTB_PATH, EGTB_PIECES, threads);
+		} else if (strncmp(msg, "tune", 4) == 0) {
+			char filename[256];
+			int threads = 1, epochs = 1000;
+
+			if (sscanf(msg + 5, "%255s %d %d", filename, &threads, &epochs) >= 1)
+				tune(filename, max(1, threads), epochs);
+		} else if (strncmp(msg, "quit", 4) == 0)
 			break;
 		else if (strncmp(msg, "test", 4) == 0) {
 			fprintf(stdout, "\n"
 					"test perft <depth>     tests perft from the specified depth [4/5/6]\n"
 					"test keys            tests if Zobrist keys and how they are updated is working\n"
 					"test draw            tests if draw checking is working\n"
-					"test see             tests if the SEE is working\n\n");
+					"test see             tests if the SEE is working\n"
+					"test kpk             tests if the KPK bitbase is working\n\n");
 		} else {
 			fprintf(stdout, "\n"
 					"uci                  switches to uci mode\n"
@@ -111,6 +135,8 @@ static void listen(void) {
 					"eval                 evaluates the current board\n"
 					"depth <depth>        searches the current board to the given depth\n"
 					"perft <depth>        counts the number of moves for the current board\n"
+					"egtb <threads>       generates the endgame tables into the egtb folder\n"
+					"tune <file> <threads> <epochs>  tunes the evaluation over a set of positions\n"
 					"test                 shows test menu\n"
 					"test <id>            runs a test by id\n"
 					"help                 shows this menu\n"
@@ -125,6 +151,7 @@ static void listen(void) {
 
 void defaultSettings(Settings *settings) {
 	settings->stop = 0;
+	settings->ponder = 0;
 	settings->depth = MAX_DEPTH;
 	settings->nodes = 0;
 	settings->mate = 0;
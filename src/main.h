@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #define ENGINE_NAME "Achillees"
 #define ENGINE_AUTHOR "tempate"
@@ -22,10 +23,11 @@ extern uint64_t bitmask[64];
 extern uint64_t inBetweenLookup[64][64];
 
 typedef struct {
-	int stop;
+	atomic_int stop;	// Written by the UCI thread while the search runs
+	atomic_int ponder;	// Searching on the opponent's time, until the ponderhit
 
 	int depth;
-	int nodes;
+	uint64_t nodes;
 	int mate;
 
 	int wtime;
@@ -5,25 +5,32 @@
 #include "hashtables.h"
 
 
-static uint64_t attackedSquares(Board *board);
-static uint64_t pinnedPieces   (const Board *board);
+static inline void fillAttackInfoSide(const Board *board, AttackInfo *info, const int color) __attribute__((always_inline));
+static inline int generateMovesSide(Board *board, const AttackInfo *info, Move *moves, const int color) __attribute__((always_inline));
+static inline int generateQuietChecksSide(Board *board, const AttackInfo *info, Move *moves, const int color) __attribute__((always_inline));
+static inline int generateEvasionsSide(Board *board, const AttackInfo *info, Move *moves, const int color) __attribute__((always_inline));
 
-static int numberOfChecks(const Board *board);
-static uint64_t checkingAttack(const Board *board);
+static uint64_t blockers(const Board *board, const int kingIndex, const uint64_t candidates, const int color);
 
-static uint64_t knightAttacks(const Board *board, const int color);
-static void knightMoves(const Board *board, Move **moves, const uint64_t checkAttacks, const uint64_t pinned);
+static inline uint64_t pieceSources(const Board *board, const int to, const uint64_t movable, const int color) __attribute__((always_inline));
+static inline uint64_t pawnPushSources(const Board *board, const int to, const uint64_t movable, const int color) __attribute__((always_inline));
+static inline void saveEvasions(const Board *board, Move **moves, uint64_t sources, const int to, const int type, const int color) __attribute__((always_inline));
+static void enPassantEvasions(Board *board, const int checker, Move **moves, const int color);
 
-static uint64_t kingAttacks(const Board *board, const int color);
-static void kingMoves(const Board *board, Move **moves, const uint64_t attacked, const uint64_t check);
+static uint64_t fillPieceAttacks(AttackInfo *info, uint64_t bb, uint64_t (*movesFunc)(int, uint64_t), const uint64_t occupied, const uint64_t king);
 
-static uint64_t slidingAttacks(const Board *board, uint64_t (*movesFunc)(int, uint64_t), uint64_t bb);
-static void slidingMoves(const Board *board, Move **moves, const int piece, const int color, uint64_t (*movesFunc)(int, uint64_t), const uint64_t checkAttacks, const uint64_t pinned);
+static inline void knightMoves(const Board *board, const AttackInfo *info, Move **moves, const uint64_t checkAttacks, const int color) __attribute__((always_inline));
+static inline void kingMoves(const Board *board, const AttackInfo *info, Move **moves, const int color) __attribute__((always_inline));
+static inline void slidingMoves(const Board *board, const AttackInfo *info, Move **moves, const int piece, const uint64_t checkAttacks, const int color) __attribute__((always_inline));
 
+static inline uint64_t knightTargets(const int index, const uint64_t occupied);
+static inline uint64_t kingTargets  (const int index, const uint64_t occupied);
 static inline uint64_t queenAttacks (const int index, const uint64_t occupied);
 
 static inline void saveMoves(Move **moves, const int piece, const uint64_t movesBB, const int from, const int color, const int type, const uint64_t toBB);
 
+static inline int isQuietCheck(const Board *board, const AttackInfo *info, const int piece, const int from, const int to, const int color);
+
 
 // Lookup Tables
 
@@ -59,38 +66,266 @@ uint64_t perft(Board *board, int depth) {
 }
 
 int legalMoves(Board *board, Move *moves) {
+	AttackInfo info;
+
+	fillAttackInfo(board, &info);
+
+	return generateMoves(board, &info, moves);
+}
+
+/*
+ * The generator is specialized for each side to move. The bodies below are
+ * always inlined with a constant color, so that the per-color shifts and
+ * masks fold at compile time, and the public functions dispatch once per node.
+ */
+
+void fillAttackInfo(const Board *board, AttackInfo *info) {
+	if (board->turn == WHITE)
+		fillAttackInfoSide(board, info, WHITE);
+	else
+		fillAttackInfoSide(board, info, BLACK);
+}
+
+int generateMoves(Board *board, const AttackInfo *info, Move *moves) {
+	return (board->turn == WHITE) ? generateMovesSide(board, info, moves, WHITE)
+								  : generateMovesSide(board, info, moves, BLACK);
+}
+
+int generateQuietChecks(Board *board, const AttackInfo *info, Move *moves) {
+	return (board->turn == WHITE) ? generateQuietChecksSide(board, info, moves, WHITE)
+								  : generateQuietChecksSide(board, info, moves, BLACK);
+}
+
+int generateEvasions(Board *board, const AttackInfo *info, Move *moves) {
+	return (board->turn == WHITE) ? generateEvasionsSide(board, info, moves, WHITE)
+								  : generateEvasionsSide(board, info, moves, BLACK);
+}
+
+/*
+ * Computes the attacks of every piece on the board.
+ * All the slider lookups of a node are done here, so that
+ * the move generation and the evaluation don't repeat them.
+ */
+static inline void fillAttackInfoSide(const Board *board, AttackInfo *info, const int color) {
+	const int opcolor = 1 ^ color;
+	const int kingIndex = board->kingIndex[color];
+
+	info->checkers = 0;
+
+	for (int c = WHITE; c <= BLACK; ++c) {
+		// The opponent's pieces that attack our king are saved as checkers
+		const uint64_t king = (c == color) ? 0 : board->pieces[color][KING];
+
+		info->attacks[c][PAWN]   = pawnAttacks(board, c);
+		info->attacks[c][KNIGHT] = fillPieceAttacks(info, board->pieces[c][KNIGHT], knightTargets, board->occupied, king);
+		info->attacks[c][BISHOP] = fillPieceAttacks(info, board->pieces[c][BISHOP], bishopAttacks, board->occupied, king);
+		info->attacks[c][ROOK]   = fillPieceAttacks(info, board->pieces[c][ROOK],   rookAttacks,   board->occupied, king);
+		info->attacks[c][QUEEN]  = fillPieceAttacks(info, board->pieces[c][QUEEN],  queenAttacks,  board->occupied, king);
+		info->attacks[c][KING]   = fillPieceAttacks(info, board->pieces[c][KING],   kingTargets,   board->occupied, 0);
+
+		info->attacked[c] = info->attacks[c][PAWN]   | info->attacks[c][KNIGHT] |
+							info->attacks[c][BISHOP] | info->attacks[c][ROOK]   |
+							info->attacks[c][QUEEN]  | info->attacks[c][KING];
+	}
+
+	info->checkers |= pawnAttacksLookup[color][kingIndex] & board->pieces[opcolor][PAWN];
+
+	// A checking slider also attacks the square behind the king, so the king can't flee there.
+	uint64_t sliders = info->checkers & ~(board->pieces[opcolor][PAWN] | board->pieces[opcolor][KNIGHT]);
+
+	if (sliders) do {
+		const int sqr = bitScanForward(sliders);
+		info->attacked[opcolor] |= line(kingIndex, sqr) & kingLookup[kingIndex] & ~bitmask[sqr];
+	} while (unsetLSB(sliders));
+
+	info->pinned = blockers(board, kingIndex, board->players[color], opcolor);
+
+	// Squares from which each of our pieces would check the enemy king
+	const int enemyKing = board->kingIndex[opcolor];
+
+	info->checkSquares[PAWN]   = pawnAttacksLookup[opcolor][enemyKing];
+	info->checkSquares[KNIGHT] = knightLookup[enemyKing];
+	info->checkSquares[BISHOP] = bishopAttacks(enemyKing, board->occupied);
+	info->checkSquares[ROOK]   = rookAttacks(enemyKing, board->occupied);
+	info->checkSquares[QUEEN]  = info->checkSquares[BISHOP] | info->checkSquares[ROOK];
+	info->checkSquares[KING]   = 0;
+
+	info->discoverers = blockers(board, enemyKing, board->players[color], color);
+}
+
+static inline int generateMovesSide(Board *board, const AttackInfo *info, Move *moves, const int color) {
 	
 	Move *ptr = moves;
 
-	const uint64_t attacked = attackedSquares(board);
-	const uint64_t pinned = pinnedPieces(board);
+	if (info->checkers) {
+		ASSERT(inCheck(board));
+		return generateEvasionsSide(board, info, moves, color);
+	}
 
-	const uint64_t check = attacked & board->pieces[board->turn][KING];
-	uint64_t checkAttack = NO_CHECK;
+	pawnMoves  (board, &ptr, NO_CHECK, info->pinned);
+	knightMoves(board, info, &ptr, NO_CHECK, color);
 
-	if (check) {
-		ASSERT(inCheck(board));
+	slidingMoves(board, info, &ptr, BISHOP, NO_CHECK, color);
+	slidingMoves(board, info, &ptr, ROOK,   NO_CHECK, color);
+	slidingMoves(board, info, &ptr, QUEEN,  NO_CHECK, color);
 
-		if (numberOfChecks(board) == 1) {
-			checkAttack = checkingAttack(board);
-		} else {
-			kingMoves(board, &ptr, attacked, check);
-			return ptr - moves;
-		}
+	kingMoves  (board, info, &ptr, color);
+
+	return ptr - moves;
+}
+
+/*
+ * Generates the legal non-capturing moves that give check, either directly
+ * or by uncovering a slider. Promotions and castling aren't included.
+ * It must not be called when the side to move is in check.
+ */
+static inline int generateQuietChecksSide(Board *board, const AttackInfo *info, Move *moves, const int color) {
+	ASSERT(!info->checkers);
+
+	Move *ptr = moves;
+
+	const int opcolor = 1 ^ color;
+	const int kingIndex = board->kingIndex[color];
+	const int enemyKing = board->kingIndex[opcolor];
+
+	// Pawn pushes, one or two squares
+	static const uint64_t rank1AndRank8 = 0xff000000000000ff;
+
+	const uint64_t startRank = (color == WHITE) ? 0xff00 : 0xff000000000000;
+	const int forward = (color == WHITE) ? 8 : -8;
+	uint64_t pawns = board->pieces[color][PAWN];
+
+	if (pawns) do {
+		const int from = bitScanForward(pawns);
+		const int to = from + forward;
+
+		if (!(board->empty & bitmask[to]) || (bitmask[to] & rank1AndRank8))
+			continue;
+
+		if (isQuietCheck(board, info, PAWN, from, to, color))
+			*ptr++ = (Move){.from=from, .to=to, .piece=PAWN, .color=color, .type=QUIET, .castle=-1};
+
+		if ((startRank & bitmask[from]) && (board->empty & bitmask[to + forward]) &&
+			isQuietCheck(board, info, PAWN, from, to + forward, color))
+			*ptr++ = (Move){.from=from, .to=to + forward, .enPassant=to, .piece=PAWN, .color=color, .type=QUIET, .castle=-1};
+	} while (unsetLSB(pawns));
+
+	// Knights and sliders
+	for (int piece = KNIGHT; piece <= QUEEN; ++piece) {
+		uint64_t bb = board->pieces[color][piece];
+
+		if (bb) do {
+			const int from = bitScanForward(bb);
+
+			uint64_t targets = info->pieceAttacks[from] & board->empty;
+
+			// A pinned piece can only move along the pin
+			if (info->pinned & bitmask[from])
+				targets &= line(from, kingIndex);
+
+			// Moving a discoverer off the line to the king is always a check
+			if (info->discoverers & bitmask[from])
+				targets &= info->checkSquares[piece] | ~line(from, enemyKing);
+			else
+				targets &= info->checkSquares[piece];
+
+			saveMoves(&ptr, piece, targets, from, color, QUIET, board->empty);
+		} while (unsetLSB(bb));
 	}
 
-	pawnMoves  (board, &ptr, checkAttack, pinned);
-	knightMoves(board, &ptr, checkAttack, pinned);
+	// The king can only give a discovered check
+	if (info->discoverers & bitmask[kingIndex]) {
+		const uint64_t targets = info->pieceAttacks[kingIndex] & board->empty &
+				~info->attacked[opcolor] & ~line(kingIndex, enemyKing);
+
+		saveMoves(&ptr, KING, targets, kingIndex, color, QUIET, board->empty);
+	}
+
+	return ptr - moves;
+}
+
+/*
+ * Generates the legal moves of a side in check. Besides the king moves,
+ * only the captures of the checker and the interpositions between it
+ * and the king are looked at.
+ */
+static inline int generateEvasionsSide(Board *board, const AttackInfo *info, Move *moves, const int color) {
+	ASSERT(info->checkers);
+
+	Move *ptr = moves;
+
+	kingMoves(board, info, &ptr, color);
+
+	// Only the king can escape a double check
+	if (info->checkers & (info->checkers - 1))
+		return ptr - moves;
+
+	const int checker = bitScanForward(info->checkers);
 
-	slidingMoves(board, &ptr, BISHOP, board->turn, bishopAttacks, checkAttack, pinned);
-	slidingMoves(board, &ptr, ROOK,   board->turn, rookAttacks,   checkAttack, pinned);
-	slidingMoves(board, &ptr, QUEEN,  board->turn, queenAttacks,  checkAttack, pinned);
+	// Pinned pieces can never stop a check
+	const uint64_t movable = board->players[color] & ~info->pinned & ~board->pieces[color][KING];
 
-	kingMoves  (board, &ptr, attacked, check);
+	const uint64_t pawnCaptures = pawnAttacksLookup[1 ^ color][checker] & board->pieces[color][PAWN] & movable;
+
+	saveEvasions(board, &ptr, pieceSources(board, checker, movable, color) | pawnCaptures, checker, CAPTURE, color);
+
+	if (board->enPassant)
+		enPassantEvasions(board, checker, &ptr, color);
+
+	uint64_t blocks = inBetweenLookup[board->kingIndex[color]][checker];
+
+	if (blocks) do {
+		const int to = bitScanForward(blocks);
+		saveEvasions(board, &ptr, pieceSources(board, to, movable, color) | pawnPushSources(board, to, movable, color), to, QUIET, color);
+	} while (unsetLSB(blocks));
 
 	return ptr - moves;
 }
 
+/*
+ * Tells if the side to move is checkmated, stopping at the first evasion found.
+ */
+int isCheckmate(Board *board, const AttackInfo *info) {
+	if (!info->checkers)
+		return 0;
+
+	const int color = board->turn;
+	const int kingIndex = board->kingIndex[color];
+
+	if (info->pieceAttacks[kingIndex] & ~board->players[color] & ~info->attacked[board->opponent])
+		return 0;
+
+	if (info->checkers & (info->checkers - 1))
+		return 1;
+
+	const int checker = bitScanForward(info->checkers);
+	const uint64_t movable = board->players[color] & ~info->pinned & ~board->pieces[color][KING];
+
+	if (pieceSources(board, checker, movable, color) ||
+		(pawnAttacksLookup[board->opponent][checker] & board->pieces[color][PAWN] & movable))
+		return 0;
+
+	uint64_t blocks = inBetweenLookup[kingIndex][checker];
+
+	if (blocks) do {
+		const int to = bitScanForward(blocks);
+
+		if (pieceSources(board, to, movable, color) || pawnPushSources(board, to, movable, color))
+			return 0;
+	} while (unsetLSB(blocks));
+
+	if (board->enPassant) {
+		Move moves[2];
+		Move *ptr = moves;
+
+		enPassantEvasions(board, checker, &ptr, color);
+
+		return ptr == moves;
+	}
+
+	return 1;
+}
+
 int kingAttacked(const Board *board, const int color) {
 	const int kingIndex = board->kingIndex[color];
 	const int opcolor = 1 ^ color;
@@ -106,130 +341,164 @@ int kingAttacked(const Board *board, const int color) {
 	return 0;
 }
 
-static int numberOfChecks(const Board *board) {
-	const int kingIndex = board->kingIndex[board->turn];
+/*
+ * Returns the candidates that are the only piece between the king
+ * and a slider of the given color.
+ */
+static uint64_t blockers(const Board *board, const int kingIndex, const uint64_t candidates, const int color) {
 
-	uint64_t checks = 0;
+	uint64_t pinners = (xrayBishopAttacks(kingIndex, board->occupied, candidates) &
+			  	  	   (board->pieces[color][BISHOP] | board->pieces[color][QUEEN])) |
 
-	checks |= pawnAttacksLookup[board->turn][kingIndex] &  board->pieces[board->opponent][PAWN];
-	checks |= bishopAttacks(kingIndex, board->occupied) & (board->pieces[board->opponent][QUEEN] | board->pieces[board->opponent][BISHOP]);
-	checks |= rookAttacks  (kingIndex, board->occupied) & (board->pieces[board->opponent][QUEEN] | board->pieces[board->opponent][ROOK]);
-	checks |= knightLookup[kingIndex] & board->pieces[board->opponent][KNIGHT];
-	checks |= kingLookup  [kingIndex] & board->pieces[board->opponent][KING];
+			  	  	   (xrayRookAttacks(kingIndex, board->occupied, candidates) &
+			  	  	   (board->pieces[color][ROOK] | board->pieces[color][QUEEN]));
+	
+	uint64_t pinned = 0;
 
-	return popCount(checks);
-}
+	if (pinners) do {
+		const int sqr = bitScanForward(pinners);
+		pinned |= inBetweenLookup[kingIndex][sqr] & candidates;
+	} while (unsetLSB(pinners));
 
-static uint64_t checkingAttack(const Board *board) {
-	const int kingIndex = board->kingIndex[board->turn];
+	return pinned;
+}
 
+/*
+ * Saves the attacks of every piece in the bitboard and returns their union.
+ * The pieces attacking the king are added to the checkers.
+ */
+static uint64_t fillPieceAttacks(AttackInfo *info, uint64_t bb, uint64_t (*movesFunc)(int, uint64_t), const uint64_t occupied, const uint64_t king) {
 	uint64_t attacks = 0;
 
-	attacks |= pawnAttacksLookup[board->turn][kingIndex] & board->pieces[board->opponent][PAWN];
-	attacks |= knightLookup[kingIndex] & board->pieces[board->opponent][KNIGHT];
-
-	uint64_t checkingSliders =
-			(bishopAttacks(kingIndex, board->occupied) & (board->pieces[board->opponent][QUEEN] | board->pieces[board->opponent][BISHOP])) |
-			(rookAttacks  (kingIndex, board->occupied) & (board->pieces[board->opponent][QUEEN] | board->pieces[board->opponent][ROOK]));
+	if (bb) do {
+		const int sqr = bitScanForward(bb);
 
-	attacks |= checkingSliders;
+		info->pieceAttacks[sqr] = movesFunc(sqr, occupied);
+		attacks |= info->pieceAttacks[sqr];
 
-	if (checkingSliders) do {
-		const int attacker = bitScanForward(checkingSliders);
-		attacks |= inBetweenLookup[kingIndex][attacker];
-	} while (unsetLSB(checkingSliders));
+		if (info->pieceAttacks[sqr] & king)
+			info->checkers |= bitmask[sqr];
+	} while (unsetLSB(bb));
 
 	return attacks;
 }
 
-static uint64_t attackedSquares(Board *board) {
-	board->occupied ^= board->pieces[board->turn][KING];
+// EVASIONS
+
+// Our knights and sliders that can move to the square
+static inline uint64_t pieceSources(const Board *board, const int to, const uint64_t movable, const int color) {
+	const uint64_t queens = board->pieces[color][QUEEN];
+
+	return ((knightLookup[to] & board->pieces[color][KNIGHT]) |
+			(bishopAttacks(to, board->occupied) & (board->pieces[color][BISHOP] | queens)) |
+			(rookAttacks  (to, board->occupied) & (board->pieces[color][ROOK]   | queens))) & movable;
+}
+
+// Our pawns that can be pushed to the empty square
+static inline uint64_t pawnPushSources(const Board *board, const int to, const uint64_t movable, const int color) {
+	const uint64_t doublePushRank = (color == WHITE) ? 0xff000000 : 0xff00000000;
+
+	const int from = (color == WHITE) ? to - 8 : to + 8;
+	const uint64_t pawns = board->pieces[color][PAWN] & movable;
 
-	const uint64_t attacked = pawnAttacks  (board, board->opponent) |
-							  knightAttacks(board, board->opponent) |
-							  kingAttacks  (board, board->opponent) |
-							  slidingAttacks(board, bishopAttacks, board->pieces[board->opponent][BISHOP]) |
-							  slidingAttacks(board, rookAttacks,   board->pieces[board->opponent][ROOK])   |
-							  slidingAttacks(board, queenAttacks,  board->pieces[board->opponent][QUEEN]);
+	if (from < 0 || from > 63)
+		return 0;
 
-	board->occupied ^= board->pieces[board->turn][KING];
+	if ((doublePushRank & bitmask[to]) && (board->empty & bitmask[from]))
+		return bitmask[(color == WHITE) ? from - 8 : from + 8] & pawns;
 
-	return attacked;
+	return bitmask[from] & pawns;
 }
 
-static uint64_t pinnedPieces(const Board *board) {
+static inline void saveEvasions(const Board *board, Move **moves, uint64_t sources, const int to, const int type, const int color) {
+	static const uint64_t rank1AndRank8 = 0xff000000000000ff;
+	static const int promotions[4] = {QUEEN, KNIGHT, BISHOP, ROOK};
 
-	const int kingIndex = board->kingIndex[board->turn];
-	const uint64_t possiblePinned = board->players[board->turn];
+	if (sources) do {
+		const int from = bitScanForward(sources);
 
-	uint64_t pinners = (xrayBishopAttacks(kingIndex, board->occupied, possiblePinned) &
-			  	  	   (board->pieces[board->opponent][BISHOP] | board->pieces[board->opponent][QUEEN])) |
+		int piece = PAWN;
 
-			  	  	   (xrayRookAttacks(kingIndex, board->occupied, possiblePinned) &
-			  	  	   (board->pieces[board->opponent][ROOK] | board->pieces[board->opponent][QUEEN]));
-	
-	uint64_t pinned = 0;
+		while (!(board->pieces[color][piece] & bitmask[from]))
+			++piece;
 
-	if (pinners) do {
-		const int sqr = bitScanForward(pinners);
-		pinned |= inBetweenLookup[kingIndex][sqr] & possiblePinned;
-	} while (unsetLSB(pinners));
+		if (piece == PAWN && (bitmask[to] & rank1AndRank8)) {
+			for (int i = 0; i < 4; ++i) {
+				**moves = (Move){.from=from, .to=to, .piece=PAWN, .color=color, .type=type, .castle=-1, .promotion=promotions[i]};
+				(*moves)++;
+			}
+		} else {
+			const int enPassant = (piece == PAWN && abs(to - from) == 16) ? (from + to) / 2 : 0;
 
-	return pinned;
+			**moves = (Move){.from=from, .to=to, .piece=piece, .color=color, .type=type, .castle=-1, .enPassant=enPassant};
+			(*moves)++;
+		}
+	} while (unsetLSB(sources));
 }
 
-// KNIGHT
+// An en passant capture can only stop a check given by the pawn that has just moved
+static void enPassantEvasions(Board *board, const int checker, Move **moves, const int color) {
+	const int captured = (color == WHITE) ? board->enPassant - 8 : board->enPassant + 8;
 
-static uint64_t knightAttacks(const Board *board, const int color) {
-	uint64_t attacks = 0;
+	if (captured != checker)
+		return;
 
-	uint64_t bb = board->pieces[color][KNIGHT];
+	uint64_t attackers = pawnAttacksLookup[1 ^ color][board->enPassant] & board->pieces[color][PAWN];
 
-	if (bb) do {
-		const int from = bitScanForward(bb);
-		attacks |= knightLookup[from];
-	} while (unsetLSB(bb));
+	// Played and tested, as the capture can uncover an attack on the king
+	if (attackers) do {
+		const Move move = (Move){.from=bitScanForward(attackers), .to=board->enPassant, .piece=PAWN, .color=color, .type=CAPTURE};
 
-	return attacks;
-}
+		History history;
 
-static void knightMoves(const Board *board, Move **moves, const uint64_t checkAttacks, const uint64_t pinned) {
-	// Knights are always absolutely pinned, so their moves don't have to be considered.
-	uint64_t bb = board->pieces[board->turn][KNIGHT] & ~pinned;
+		makeMove(board, &move, &history);
 
-	if (bb) do {
-		const int from = bitScanForward(bb);
-		const uint64_t movesBB = knightLookup[from] & checkAttacks;
+		if (!kingAttacked(board, color)) {
+			**moves = move;
+			(*moves)++;
+		}
 
-		saveMoves(moves, KNIGHT, movesBB, from, board->turn, CAPTURE, board->players[board->opponent]);
-		saveMoves(moves, KNIGHT, movesBB, from, board->turn, QUIET, board->empty);
-	} while (unsetLSB(bb));
+		undoMove(board, &move, &history);
+	} while (unsetLSB(attackers));
 }
 
-// KING
+// KNIGHT
 
-static uint64_t kingAttacks(const Board *board, const int color) {
-	uint64_t attacks = 0;
+static inline uint64_t knightTargets(const int index, const uint64_t occupied) {
+	(void) occupied;
+	return knightLookup[index];
+}
 
-	uint64_t bb = board->pieces[color][KING];
+static inline void knightMoves(const Board *board, const AttackInfo *info, Move **moves, const uint64_t checkAttacks, const int color) {
+	// Knights are always absolutely pinned, so their moves don't have to be considered.
+	uint64_t bb = board->pieces[color][KNIGHT] & ~info->pinned;
 
 	if (bb) do {
 		const int from = bitScanForward(bb);
-		attacks |= kingLookup[from];
+		const uint64_t movesBB = info->pieceAttacks[from] & checkAttacks;
+
+		saveMoves(moves, KNIGHT, movesBB, from, color, CAPTURE, board->players[1 ^ color]);
+		saveMoves(moves, KNIGHT, movesBB, from, color, QUIET, board->empty);
 	} while (unsetLSB(bb));
+}
 
-	return attacks;
+// KING
+
+static inline uint64_t kingTargets(const int index, const uint64_t occupied) {
+	(void) occupied;
+	return kingLookup[index];
 }
 
-static void kingMoves(const Board *board, Move **moves, const uint64_t attacked, const uint64_t check) {
+static inline void kingMoves(const Board *board, const AttackInfo *info, Move **moves, const int color) {
 	static const uint64_t castlingSqrs[4] = {0x60, 0xe, 0x6000000000000000, 0xe00000000000000};
 	static const uint64_t inBetweenSqr[4] = {0x60, 0xc, 0x6000000000000000, 0xc00000000000000};
 
-	const int from = board->kingIndex[board->turn];
-	const uint64_t movesBB = kingLookup[from] & ~attacked;
+	const int from = board->kingIndex[color];
+	const uint64_t attacked = info->attacked[1 ^ color];
+	const uint64_t movesBB = info->pieceAttacks[from] & ~attacked;
 
-	saveMoves(moves, KING, movesBB, from, board->turn, CAPTURE, board->players[board->opponent]);
-	saveMoves(moves, KING, movesBB, from, board->turn, QUIET, board->empty);
+	saveMoves(moves, KING, movesBB, from, color, CAPTURE, board->players[1 ^ color]);
+	saveMoves(moves, KING, movesBB, from, color, QUIET, board->empty);
 
 
 	/* Castling. Ensures that:
@@ -239,12 +508,12 @@ static void kingMoves(const Board *board, Move **moves, const uint64_t attacked,
 	 * 		- The squares the king passes through are free.
 	 */
 
-	 if (!check) {
- 		int index = 2 * board->turn;
+	 if (!info->checkers) {
+ 		int index = 2 * color;
  		int castle = board->castling & bitmask[index];
 
  		if (castle && (castlingSqrs[index] & board->occupied) == 0 && (inBetweenSqr[index] & attacked) == 0) {
- 			**moves = (Move){.from=from, .to=from + 2, .piece=KING, .color=board->turn, .castle=castle};
+ 			**moves = (Move){.from=from, .to=from + 2, .piece=KING, .color=color, .castle=castle};
 			(*moves)++;
 		 }
 
@@ -252,7 +521,7 @@ static void kingMoves(const Board *board, Move **moves, const uint64_t attacked,
  		castle = board->castling & bitmask[index];
 
  		if (castle && (castlingSqrs[index] & board->occupied) == 0 && (inBetweenSqr[index] & attacked) == 0) {
- 			**moves = (Move){.from=from, .to=from - 2, .piece=KING, .color=board->turn, .castle=castle};
+ 			**moves = (Move){.from=from, .to=from - 2, .piece=KING, .color=color, .castle=castle};
 			(*moves)++;
 		}
  	}
@@ -264,25 +533,15 @@ static inline uint64_t queenAttacks(const int index, const uint64_t occupied) {
 	return bishopAttacks(index, occupied) | rookAttacks(index, occupied);
 }
 
-static uint64_t slidingAttacks(const Board *board, uint64_t (*movesFunc)(int, uint64_t), uint64_t bb) {
-	uint64_t attacks = 0;
-
-	if (bb) do
-		attacks |= movesFunc(bitScanForward(bb), board->occupied);
-	while (unsetLSB(bb));
-
-	return attacks;
-}
-
-static void slidingMoves(const Board *board, Move **moves, const int piece, const int color, uint64_t (*movesFunc)(int, uint64_t), const uint64_t checkAttacks, const uint64_t pinned) {
+static inline void slidingMoves(const Board *board, const AttackInfo *info, Move **moves, const int piece, const uint64_t checkAttacks, const int color) {
 	const int opcolor = 1 ^ color;
 
-	uint64_t pinnedSliders = board->pieces[color][piece] & pinned;
+	uint64_t pinnedSliders = board->pieces[color][piece] & info->pinned;
 	uint64_t bb = board->pieces[color][piece] ^ pinnedSliders;
 
 	if (bb) do {
 		const int from = bitScanForward(bb);
-		const uint64_t movesBB = movesFunc(from, board->occupied) & checkAttacks;
+		const uint64_t movesBB = info->pieceAttacks[from] & checkAttacks;
 
 		saveMoves(moves, piece, movesBB, from, color, CAPTURE, board->players[opcolor]);
 		saveMoves(moves, piece, movesBB, from, color, QUIET, board->empty);
@@ -291,7 +550,7 @@ static void slidingMoves(const Board *board, Move **moves, const int piece, cons
 	// A piece cannot move when the king is in check and it's pinned
 	if (checkAttacks == NO_CHECK && pinnedSliders) do {
 		const int from = bitScanForward(pinnedSliders);
-		const uint64_t movesBB = movesFunc(from, board->occupied) & line(from, board->kingIndex[color]);
+		const uint64_t movesBB = info->pieceAttacks[from] & line(from, board->kingIndex[color]);
 
 		// If the piece is pinned it can only possibly capture the pinning piece.
 		uint64_t attacker = movesBB & board->players[opcolor];
@@ -319,76 +578,50 @@ int isLegalMove(Board *board, const Move *move) {
 }
 
 
-int givesCheck(const Board *board, const Move *move) {
-
+/*
+ * Uses the check squares and discovered check candidates of the node.
+ * Only castling, en passant and promotions, which change the occupancy
+ * along the lines to the king, need the attacks to be recomputed.
+ */
+int givesCheck(const Board *board, const AttackInfo *info, const Move *move) {
 	static const uint64_t castledRook[4] = {0x20, 8, 0x2000000000000000, 0x800000000000000};
 
-	uint64_t bishsAndQueens = board->pieces[board->turn][BISHOP] | board->pieces[board->turn][QUEEN];
-	uint64_t rooksAndQueens = board->pieces[board->turn][ROOK]   | board->pieces[board->turn][QUEEN];
+	const int enemyKing = board->kingIndex[board->opponent];
 
-	uint64_t occupied = (board->occupied | bitmask[move->to]) ^ bitmask[move->from];
-
-	switch (move->piece) {
-	case PAWN:
-
-		switch (move->promotion) {
-		case KNIGHT:
-
-			if (knightLookup[move->to] & board->pieces[board->opponent][KING])
-				return 1;
-
-			break;
-		case BISHOP:
-			bishsAndQueens ^= bitmask[move->to];
-			break;
-		case ROOK:
-			rooksAndQueens ^= bitmask[move->to];
-			break;
-		case QUEEN:
-			bishsAndQueens ^= bitmask[move->to];
-			rooksAndQueens ^= bitmask[move->to];
-			break;
-		default:
+	// Direct check
+	if (info->checkSquares[move->promotion ? move->promotion : move->piece] & bitmask[move->to])
+		return 1;
 
-			if (pawnAttacksLookup[move->color][move->to] & board->pieces[board->opponent][KING])
-				return 1;
+	// Discovered check, the piece leaves the line between the slider and the king
+	if ((info->discoverers & bitmask[move->from]) && !(line(move->from, enemyKing) & bitmask[move->to]))
+		return 1;
 
-			if (move->to == board->enPassant)
-				occupied ^= bitmask[move->to - 8 + 16 * move->color];
-		}
+	const uint64_t occupied = (board->occupied | bitmask[move->to]) ^ bitmask[move->from];
 
-		break;
-	case KNIGHT:
+	if (move->piece == KING && move->castle > 0) {
+		const uint64_t rook = castledRook[bitScanForward(move->castle)];
+		return (rookAttacks(enemyKing, occupied) & rook) != 0;
+	}
 
-		if (knightLookup[move->to] & board->pieces[board->opponent][KING])
-			return 1;
+	if (move->promotion) {
+		const uint64_t attacks = (move->promotion == KNIGHT) ? 0 :
+				(move->promotion == BISHOP) ? bishopAttacks(move->to, occupied) :
+				(move->promotion == ROOK)   ? rookAttacks(move->to, occupied)   :
+				bishopAttacks(move->to, occupied) | rookAttacks(move->to, occupied);
 
-		break;
-	case BISHOP:
-		bishsAndQueens ^= bitmask[move->from] | bitmask[move->to];
-		break;
-	case ROOK:
-		rooksAndQueens ^= bitmask[move->from] | bitmask[move->to];
-		break;
-	case QUEEN:
-		bishsAndQueens ^= bitmask[move->from] | bitmask[move->to];
-		rooksAndQueens ^= bitmask[move->from] | bitmask[move->to];
-		break;
-	case KING:
-
-		if (move->castle != -1)
-			rooksAndQueens ^= castledRook[bitScanForward(move->castle)];
-
-		break;
+		return (attacks & bitmask[enemyKing]) != 0;
 	}
 
-	// Discovered checks
+	// En passant also removes the captured pawn from the line
+	if (move->piece == PAWN && board->enPassant && move->to == board->enPassant) {
+		const uint64_t after = occupied ^ bitmask[move->to - 8 + 16 * move->color];
 
-	if (bishsAndQueens & bishopAttacks(board->kingIndex[board->opponent], occupied))
-		return 1;
+		const uint64_t bishsAndQueens = board->pieces[board->turn][BISHOP] | board->pieces[board->turn][QUEEN];
+		const uint64_t rooksAndQueens = board->pieces[board->turn][ROOK]   | board->pieces[board->turn][QUEEN];
 
-	if (rooksAndQueens & rookAttacks(board->kingIndex[board->opponent], occupied))
-		return 1;
+		return (bishsAndQueens & bishopAttacks(enemyKing, after)) ||
+			   (rooksAndQueens & rookAttacks(enemyKing, after));
+	}
 
 	return 0;
 }
@@ -508,4 +741,15 @@ void printMove(const Move move, const int nodes) {
 
 	fprintf(stdout, "%s\t%d\n", text, nodes);
 	fflush(stdout);
-}
\ No newline at end of file
+}
+
+/*
+ * Whether moving the piece to an empty square is legal and gives check.
+ */
+static inline int isQuietCheck(const Board *board, const AttackInfo *info, const int piece, const int from, const int to, const int color) {
+	if ((info->pinned & bitmask[from]) && !(line(from, board->kingIndex[color]) & bitmask[to]))
+		return 0;
+
+	return (info->checkSquares[piece] & bitmask[to]) ||
+		   ((info->discoverers & bitmask[from]) && !(line(from, board->kingIndex[1 ^ color]) & bitmask[to]));
+}
@@ -30,11 +30,35 @@ typedef struct {
 	int fiftyMoves;
 } History;
 
+/*
+ * Attack bitboards of a position, computed once per node and shared
+ * by the move generator and the evaluation.
+ */
+typedef struct {
+	uint64_t pieceAttacks[64];	// Squares attacked by the piece on each square
+	uint64_t attacks[2][6];		// Squares attacked by each type of piece
+	uint64_t attacked[2];		// Squares attacked by each side
+
+	uint64_t checkers;
+	uint64_t pinned;
+
+	uint64_t checkSquares[6];	// Squares where each of our pieces would give check
+	uint64_t discoverers;		// Our pieces that give a discovered check when they move
+} AttackInfo;
+
+extern const uint64_t knightLookup[64];
 extern const uint64_t kingLookup[64];
 
 uint64_t perft(Board *board, int depth);
 
+void fillAttackInfo(const Board *board, AttackInfo *info);
+
 int legalMoves(Board *board, Move *moves);
+int generateMoves(Board *board, const AttackInfo *info, Move *moves);
+int generateQuietChecks(Board *board, const AttackInfo *info, Move *moves);
+int generateEvasions(Board *board, const AttackInfo *info, Move *moves);
+
+int isCheckmate(Board *board, const AttackInfo *info);
 
 int kingAttacked(const Board *board, const int color);
 
@@ -43,7 +67,7 @@ static inline int inCheck(const Board *board) {
 }
 
 int isLegalMove(Board *board, const Move *move);
-int givesCheck(const Board *board, const Move *move);
+int givesCheck(const Board *board, const AttackInfo *info, const Move *move);
 int getSmallestAttacker(Board *board, const int sqr, const int color);
 
 static inline int compareMoves(const Move *moveA, const Move *moveB) {
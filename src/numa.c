@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <pthread.h>
+
+#include "main.h"
+#include "numa.h"
+
+
+static int readList(const char *path, cpu_set_t *set);
+static int parseList(const char *list, cpu_set_t *set);
+
+/*
+ * The topology is read from sysfs. On a machine with several nodes the
+ * threads of the engine are bound to the node it was started on, so that
+ * the TT, which is first touched by the bound UCI thread, stays local to
+ * the search. With a single node nothing is done.
+ */
+static cpu_set_t nodeCpus[MAX_NUMA_NODES];
+static int nNodes = 0;
+static int maxNode = -1;
+
+static int homeNode = 0;
+
+int numaBinding = 1;
+
+void initNuma(void) {
+	cpu_set_t online;
+
+	if (!readList(NUMA_PATH "/online", &online))
+		return;
+
+	const int cpu = sched_getcpu();
+
+	for (int node = 0; node < MAX_NUMA_NODES; ++node) {
+		if (!CPU_ISSET(node, &online))
+			continue;
+
+		char path[64];
+		snprintf(path, sizeof(path), NUMA_PATH "/node%d/cpulist", node);
+
+		// Nodes with memory only have no CPUs to bind to
+		if (!readList(path, &nodeCpus[node]) || CPU_COUNT(&nodeCpus[node]) == 0)
+			continue;
+
+		if (cpu >= 0 && CPU_ISSET(cpu, &nodeCpus[node]))
+			homeNode = node;
+
+		maxNode = node;
+		++nNodes;
+	}
+
+	bindToNumaNode();
+}
+
+/*
+ * Binds the calling thread to the CPUs of the home node, or lets it run
+ * on any of them when the binding is disabled.
+ */
+void bindToNumaNode(void) {
+	if (nNodes < 2)
+		return;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+
+	if (numaBinding) {
+		CPU_OR(&cpus, &cpus, &nodeCpus[homeNode]);
+	} else {
+		for (int node = 0; node <= maxNode; ++node)
+			CPU_OR(&cpus, &cpus, &nodeCpus[node]);
+	}
+
+	pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+}
+
+void printNumaInfo(void) {
+	if (nNodes < 2)
+		fprintf(stdout, "info string numa nodes %d, threads not bound\n", max(nNodes, 1));
+	else if (numaBinding)
+		fprintf(stdout, "info string numa nodes %d, threads bound to node %d (%d cpus)\n",
+				nNodes, homeNode, CPU_COUNT(&nodeCpus[homeNode]));
+	else
+		fprintf(stdout, "info string numa nodes %d, threads not bound\n", nNodes);
+
+	fflush(stdout);
+}
+
+
+// AUX
+
+static int readList(const char *path, cpu_set_t *set) {
+	FILE *file = fopen(path, "r");
+
+	if (file == NULL)
+		return 0;
+
+	char list[4096];
+	const int read = fgets(list, sizeof(list), file) != NULL;
+
+	fclose(file);
+
+	return read && parseList(list, set);
+}
+
+// Parses a sysfs list of ranges, such as "0-7,16-23"
+static int parseList(const char *list, cpu_set_t *set) {
+	CPU_ZERO(set);
+
+	while (*list >= '0' && *list <= '9') {
+		char *end;
+
+		const int first = strtol(list, &end, 10);
+		int last = first;
+
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+
+		if (first < 0 || last >= CPU_SETSIZE || first > last)
+			return 0;
+
+		for (int i = first; i <= last; ++i)
+			CPU_SET(i, set);
+
+		list = (*end == ',') ? end + 1 : end;
+	}
+
+	return 1;
+}
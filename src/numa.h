@@ -0,0 +1,15 @@
+#ifndef SRC_NUMA_H_
+#define SRC_NUMA_H_
+
+#define NUMA_PATH "/sys/devices/system/node"
+#define MAX_NUMA_NODES 64
+
+// Whether the engine's threads are bound to a node, it's a UCI option
+extern int numaBinding;
+
+void initNuma(void);
+void bindToNumaNode(void);
+
+void printNumaInfo(void);
+
+#endif /* SRC_NUMA_H_ */
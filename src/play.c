@@ -3,18 +3,39 @@
 #include "hashtables.h"
 
 
-static void setBits  (Board *board, const int color, const int piece, const int index);
-static void unsetBits(Board *board, const int color, const int piece, const int index);
+static inline void makeMoveSide(Board *board, const Move *move, History *history, const int color) __attribute__((always_inline));
+static inline void undoMoveSide(Board *board, const Move *move, const History *history, const int color) __attribute__((always_inline));
 
-static void checkCapture(Board *board, History *history, const int index, const int color);
-static void removeCastlingForRook(Board *board, const int index, const int color);
+static inline void setBits  (Board *board, const int color, const int piece, const int index) __attribute__((always_inline));
+static inline void unsetBits(Board *board, const int color, const int piece, const int index) __attribute__((always_inline));
+
+static inline void checkCapture(Board *board, History *history, const int index, const int color) __attribute__((always_inline));
+static inline void removeCastlingForRook(Board *board, const int index, const int color) __attribute__((always_inline));
 
 const int castleLookup[4][3] = {{6, 7, 5}, {2, 0, 3}, {62, 63, 61}, {58, 56, 59}};
 
 
+/*
+ * Like the move generator, making and undoing a move is specialized for
+ * each color, so that the shifts and masks of the side are constants.
+ */
+
 void makeMove(Board *board, const Move *move, History *history) {
-	static const int removeCastling[2] = {12, 3};
-	const int color = move->color, opcolor = 1 ^ color;
+	if (move->color == WHITE)
+		makeMoveSide(board, move, history, WHITE);
+	else
+		makeMoveSide(board, move, history, BLACK);
+}
+
+void undoMove(Board *board, const Move *move, const History *history) {
+	if (move->color == WHITE)
+		undoMoveSide(board, move, history, WHITE);
+	else
+		undoMoveSide(board, move, history, BLACK);
+}
+
+static inline void makeMoveSide(Board *board, const Move *move, History *history, const int color) {
+	const int opcolor = 1 ^ color;
 
 	history->castling = board->castling;
 	history->enPassant = board->enPassant;
@@ -26,7 +47,7 @@ void makeMove(Board *board, const Move *move, History *history) {
 	switch (move->piece) {
 	case PAWN:
 		if (board->enPassant && move->to == board->enPassant) {
-			unsetBits(board, opcolor, PAWN, move->to - 8 + 16*color);
+			unsetBits(board, opcolor, PAWN, (color == WHITE) ? move->to - 8 : move->to + 8);
 			setBits(board, color, PAWN, move->to);
 		} else if (move->promotion) {
 			setBits(board, color, move->promotion, move->to);
@@ -42,7 +63,7 @@ void makeMove(Board *board, const Move *move, History *history) {
 	case KING:
 		
 		board->kingIndex[color] = move->to;
-		board->castling &= removeCastling[color];	// WHITE: 1100   BLACK: 0011
+		board->castling &= (color == WHITE) ? 12 : 3;	// WHITE: 1100   BLACK: 0011
 
 		/*
 		 * The fifty-move counter is increased automatically on castles because
@@ -79,8 +100,8 @@ void makeMove(Board *board, const Move *move, History *history) {
 	board->opponent ^= 1;
 }
 
-void undoMove(Board *board, const Move *move, const History *history) {
-	const int color = move->color, opcolor = 1 ^ color;
+static inline void undoMoveSide(Board *board, const Move *move, const History *history, const int color) {
+	const int opcolor = 1 ^ color;
 
 	board->castling = history->castling;
 	board->enPassant = history->enPassant;
@@ -92,7 +113,7 @@ void undoMove(Board *board, const Move *move, const History *history) {
 	case PAWN:
 		if (board->enPassant && move->to == board->enPassant) {
 			// Adds the pawn captured en passant
-			setBits(board, opcolor, PAWN, move->to - 8 + 16*color);
+			setBits(board, opcolor, PAWN, (color == WHITE) ? move->to - 8 : move->to + 8);
 			unsetBits(board, color, PAWN, move->to);
 			break;
 		} else if (move->promotion) {
@@ -166,7 +187,7 @@ int findPiece(const Board *board, const uint64_t sqrBB, const int color) {
 
 // AUX
 
-static void setBits(Board *board, const int color, const int piece, const int index) {
+static inline void setBits(Board *board, const int color, const int piece, const int index) {
 	// Sets the bit on the general board for that player
 	setBit(&board->players[color], index);
 
@@ -174,7 +195,7 @@ static void setBits(Board *board, const int color, const int piece, const int in
 	setBit(&board->pieces[color][piece], index);
 }
 
-static void unsetBits(Board *board, const int color, const int piece, const int index) {
+static inline void unsetBits(Board *board, const int color, const int piece, const int index) {
 	// Unsets the bit on the general board for that player
 	unsetBit(&board->players[color], index);
 
@@ -182,7 +203,7 @@ static void unsetBits(Board *board, const int color, const int piece, const int
 	unsetBit(&board->pieces[color][piece], index);
 }
 
-static void checkCapture(Board *board, History *history, const int index, const int color) {
+static inline void checkCapture(Board *board, History *history, const int index, const int color) {
 	const uint64_t toBB = bitmask[index];
 
 	if (toBB & board->players[color]) {
@@ -200,14 +221,12 @@ static void checkCapture(Board *board, History *history, const int index, const
 	}
 }
 
-static void removeCastlingForRook(Board *board, const int index, const int color) {
-	static const int removeCastling[2][2] = {{14, 11}, {13, 7}};
-
+static inline void removeCastlingForRook(Board *board, const int index, const int color) {
 	// King-side castle
 	if (index == 56*color)
-		board->castling &= removeCastling[1][color];  // WHITE: 1101   BLACK: 0111
+		board->castling &= (color == WHITE) ? 13 : 7;  // WHITE: 1101   BLACK: 0111
 	
 	// Queen-side castle
 	else if (index == 56*color + 7)
-		board->castling &= removeCastling[0][color];  // WHITE: 1110   BLACK: 1011
+		board->castling &= (color == WHITE) ? 14 : 11; // WHITE: 1110   BLACK: 1011
 }
@@ -1,3 +1,5 @@
+#include <math.h>
+
 #include "board.h"
 #include "uci.h"
 #include "moves.h"
@@ -7,33 +9,119 @@
 #include "sort.h"
 #include "search.h"
 #include "hashtables.h"
+#include "egtb.h"
 
 #include <time.h>
 #include <string.h>
 
 
-static int qsearch(Board *board, int alpha, int beta);
+static int rootSearch(Board *board, int depth, int alpha, int beta);
+static inline int searchNode(Board *board, int depth, int alpha, int beta, const int nullmove, const int pvNode) __attribute__((always_inline));
+static int qsearch(Board *board, int alpha, int beta, const int depth);
+
+static void sortRootMoves(void);
+
+static int lateMoveReduction(const int depth, const int moveNumber, const Move *move, const int pvNode, const int improving);
+
+static void updatePV(Frame *frame, const Move *move);
 
 static void timeManagement(const Board *board);
+static int outOfTime(const int depth, const int score, const int prevScore);
+
+static inline int stopSearch(void);
+static int checkTime(void);
+
+// Wall clock time of the start of the search and its limits, in milliseconds
+static long startTime;
+
+// Start of our own clock: the ponderhit when pondering, written by the UCI thread
+static atomic_long clockStart;
+
+static long softLimit;	// No iteration is started past it
+static long hardLimit;	// The search is aborted past it
 
-clock_t start;
+// Nodes between two reads of the clock, calibrated from the speed of the search
+static int checkInterval;
+static int nodesToCheck;
 
 Stats stats;
 
+static int rootPly;
+
+// Search stack, indexed by the distance to the root
+static Frame stack[MAX_PLY];
+
+/*
+ * The root moves are kept between iterations. After each one they are
+ * ordered by score and, as only the best move has an exact one, by the
+ * nodes their subtrees needed: the moves that were hard to refute come first.
+ */
+static RootMove rootMoves[MAX_MOVES];
+static int nRootMoves;
+
+// Iterations the best move has stayed the same
+static int bestMoveStability;
+
+// Expected reply of the last completed iteration
+static Move expectedReply;
+
+// Ponder option of the GUI, it allows a longer soft limit
+int ponderEnabled = 0;
+
+// ProbCut parameters, they can be changed through the UCI options
+int probCutMargin = PROBCUT_MARGIN;
+int probCutDepth = PROBCUT_DEPTH;
+
+// Late move reductions and move count pruning limits, by depth and move number
+static int reductions[MAX_DEPTH + 1][MAX_MOVES];
+static int moveCountLimits[2][LMP_DEPTH + 1];
+
+void initReductions(void) {
+	for (int depth = 1; depth <= MAX_DEPTH; ++depth) {
+		for (int i = 1; i < MAX_MOVES; ++i)
+			reductions[depth][i] = (int) (0.75 + log(depth) * log(i) / 2.25);
+	}
+
+	for (int depth = 0; depth <= LMP_DEPTH; ++depth) {
+		moveCountLimits[0][depth] = (3 + depth * depth) / 2;
+		moveCountLimits[1][depth] = 3 + depth * depth;
+	}
+}
+
 Move search(Board *board) {
-	Move bestMove;
 
 	stats = (Stats){ 0 };
 
-	initKillerMoves();
+	ageHistory();
+
+	for (int i = 0; i < MAX_PLY; ++i) {
+		stack[i].killers[0] = stack[i].killers[1] = (Move){.from=0,.to=0};
+		stack[i].excludedMove = (Move){.from=0,.to=0};
+		stack[i].pvLength = 0;
+	}
+
+	rootPly = board->ply;
 
+	Move moves[MAX_MOVES];
+	nRootMoves = legalMoves(board, moves);
+	sort(board, moves, nRootMoves, stack[0].killers);
+
+	for (int i = 0; i < nRootMoves; ++i)
+		rootMoves[i] = (RootMove){.move = moves[i], .score = -INFINITY, .nodes = 0};
+
+	// A search stopped before its first iteration ends still plays a legal move
+	Move bestMove = rootMoves[0].move;
+
+	bestMoveStability = 0;
+	expectedReply = (Move){.from=0,.to=0};
+
+	startTime = clockStart = currentTime();
 	timeManagement(board);
-	start = clock();
 
-	const int index = board->key % settings.tt_entries;
+	checkInterval = nodesToCheck = MIN_CHECK_INTERVAL;
 
 	int alpha = -INFINITY, beta = INFINITY, delta;
-	int score, depth;
+	int score, prevScore = 0, depth;
 
 	for (depth = 1; depth <= settings.depth; ++depth) {
 
@@ -46,11 +134,14 @@ Move search(Board *board) {
 		}
 
 		while (1) {
-			score = pvSearch(board, depth, alpha, beta, 0);
+			score = rootSearch(board, depth, alpha, beta);
 
 			if (settings.stop)
 				break;
 
+			// The move that failed high is searched first again
+			sortRootMoves();
+
 			if (score >= beta) {
 				beta += delta;
 			} else if (score <= alpha) {
@@ -65,18 +156,33 @@ Move search(Board *board) {
 
 		if (settings.stop) break;
 
-		bestMove = decompressMove(board, &tt[index].move);
+		ASSERT(stack[0].pvLength > 0);
+		ASSERT(compareMoves(&stack[0].pv[0], &rootMoves[0].move));
 
-		Move pv[MAX_DEPTH];
-		const int nPV = probePV(*board, pv);
+		if (depth > 1 && compareMoves(&bestMove, &rootMoves[0].move))
+			++bestMoveStability;
+		else
+			bestMoveStability = 0;
 
-		const long duration = 1000 * (clock() - start) / CLOCKS_PER_SEC;
-		
-		infoString(board, depth, score, stats.nodes, duration, pv, nPV);
+		bestMove = rootMoves[0].move;
+
+		// A reply from an older iteration may answer another move
+		expectedReply = (stack[0].pvLength > 1) ? stack[0].pv[1] : (Move){.from=0,.to=0};
+
+		infoString(board, depth, score, stats.nodes, currentTime() - startTime, stack[0].pv, stack[0].pvLength);
 
 		// Stop looking when the fastest mate has been found
 		if (abs(score) == MAX_SCORE + depth / 2)
 			break;
+
+		// The mate scores don't tell the distance, but the PV of a mate reaches it
+		if (settings.mate && score >= MAX_SCORE && (stack[0].pvLength + 1) / 2 <= settings.mate)
+			break;
+
+		if (outOfTime(depth, score, prevScore))
+			break;
+
+		prevScore = score;
 	}
 
 	#ifdef DEBUG
@@ -91,19 +197,174 @@ Move search(Board *board) {
 
 	// Makes sure the bestMove has been initialized
 	ASSERT(bestMove.to != bestMove.from);
-	ASSERT(depth > 1);
 
 	return bestMove;
 }
 
+/*
+ * The move to ponder on after the last search, taken from its PV.
+ * Returns 0 if the PV didn't reach the reply.
+ */
+int getPonderMove(Move *move) {
+	*move = expectedReply;
+	return expectedReply.from != expectedReply.to;
+}
 
-int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove) {
-	if (settings.stop)
-		return 0;
+/*
+ * The opponent played the expected move: the ponder search goes on as a
+ * timed one, with our clock running from now.
+ */
+void ponderhit(void) {
+	clockStart = currentTime();
+	settings.ponder = 0;
+}
 
-	if (settings.movetime && stats.nodes % 4096 == 0 && clock() - start > settings.movetime) {
-		settings.stop = 1;
+
+/*
+ * Searches the root moves in the order of the previous iteration,
+ * saving the score and the subtree size of each of them.
+ */
+static int rootSearch(Board *board, int depth, int alpha, int beta) {
+	++stats.nodes;
+
+	Frame *frame = stack;
+	frame->pvLength = 0;
+
+	if (inCheck(board))
+		++depth;
+
+	History history;
+
+	const int prevAlpha = alpha;
+	int bestScore = -INFINITY;
+	Move bestMove = rootMoves[0].move;
+
+	int nQuiets = 0, nCaptures = 0;
+
+	// Scores of a previous search aren't comparable to the new ones
+	for (int i = 0; i < nRootMoves; ++i)
+		rootMoves[i].score = -INFINITY;
+
+	for (int i = 0; i < nRootMoves; ++i) {
+		Move *move = &rootMoves[i].move;
+		const uint64_t nodes = stats.nodes;
+
+		frame->currentMove = *move;
+		frame->reduction = 0;
+
+		makeMove(board, move, &history);
+		updateBoardKey(board, move, &history);
+		savePlayedMove(move, board->ply);
+		saveKeyToMemory(board->key);
+
+		int score;
+
+		if (isDraw(board, 1)) {
+			score = 0;
+			(frame + 1)->pvLength = 0;
+		}
+
+		else if (i == 0)
+			score = -pvSearch(board, depth - 1, -beta, -alpha, 0);
+
+		else {
+			// Late move reduction, quiet moves that don't give check
+			if (move->type == QUIET && !move->promotion && !inCheck(board))
+				frame->reduction = lateMoveReduction(depth, i, move, 1, 1);
+
+			score = -nonPvSearch(board, depth - 1 - frame->reduction, -alpha-1, -alpha, 0);
+
+			if (score > alpha && frame->reduction)
+				score = -nonPvSearch(board, depth - 1, -alpha-1, -alpha, 0);
+
+			if (score > alpha && score < beta)
+				score = -pvSearch(board, depth - 1, -beta, -alpha, 0);
+		}
+
+		freeKeyFromMemory();
+		updateBoardKey(board, move, &history);
+		undoMove(board, move, &history);
+
+		if (settings.stop)
+			return 0;
+
+		rootMoves[i].nodes = stats.nodes - nodes;
+		rootMoves[i].score = (score > alpha) ? score : -INFINITY;
+
+		if (score > bestScore) {
+			bestScore = score;
+			bestMove = *move;
+
+			if (bestScore > alpha) {
+				alpha = bestScore;
+				updatePV(frame, move);
+
+				if (alpha >= beta) {
+					if (move->type == QUIET) {
+						frame->killers[1] = frame->killers[0];
+						frame->killers[0] = *move;
+					}
+
+					updateHistory(board, move, frame->quiets, nQuiets, frame->captures, nCaptures, depth);
+					break;
+				}
+			}
+		}
+
+		if (move->type == CAPTURE)
+			frame->captures[nCaptures++] = *move;
+		else if (!move->promotion)
+			frame->quiets[nQuiets++] = *move;
+	}
+
+	int flag = EXACT;
+
+	if (bestScore <= prevAlpha)
+		flag = UPPER_BOUND;
+	else if (bestScore >= beta)
+		flag = LOWER_BOUND;
+
+	const int index = board->key % settings.tt_entries;
+	tt[index] = compressEntry(board->key, &bestMove, bestScore, depth, flag);
+
+	return bestScore;
+}
+
+/*
+ * The search is instantiated for each type of node, so that the compiler
+ * drops the branches that can't apply to it. PV nodes have an open window,
+ * the rest are searched with a null window. The root has rootSearch.
+ */
+#define SEARCH_VARIANT(name, pvNode) \
+	int name(Board *board, int depth, int alpha, int beta, const int nullmove) { \
+		return searchNode(board, depth, alpha, beta, nullmove, pvNode); \
+	}
+
+SEARCH_VARIANT(pvSearch, 1)
+SEARCH_VARIANT(nonPvSearch, 0)
+
+static inline int searchNode(Board *board, int depth, int alpha, int beta, const int nullmove, const int pvNode) {
+	ASSERT(pvNode || beta - alpha == 1);
+
+	if (stopSearch())
 		return 0;
+
+	const int ply = board->ply - rootPly;
+
+	if (ply >= MAX_PLY - 1)
+		return eval(board);
+
+	// The null move search shares the frame of its parent, as the ply doesn't change
+	Frame *frame = &stack[ply];
+
+	frame->pvLength = 0;
+
+	// A draw can be forced by going back to a position of the tree
+	if (alpha < 0 && upcomingRepetition(board, ply)) {
+		alpha = 0;
+
+		if (alpha >= beta)
+			return alpha;
 	}
 
 	const int incheck = inCheck(board);
@@ -111,15 +372,20 @@ int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove) {
 	if (incheck) 			// Check extensions
 		++depth;
 	else if (depth <= 0) 	// Quiescence search
-		return qsearch(board, alpha, beta);
+		return qsearch(board, alpha, beta, 0);
 
 	++stats.nodes;
 
 	const int index = board->key % settings.tt_entries;
 	const int ttHit = tt[index].key == board->key;
 
+	// The singular extension search of the parent excludes its TT move
+	const Move excludedMove = frame->excludedMove;
+	const int excluded = excludedMove.from != excludedMove.to;
+
 	// Transposition Table
-	if (ttHit && tt[index].depth == depth) {
+	// PV nodes are always searched so that their line is complete
+	if (ttHit && tt[index].depth == depth && !pvNode && !excluded) {
 		
 		#ifdef DEBUG
 		++stats.ttHits;
@@ -140,17 +406,34 @@ int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove) {
 			return tt[index].score;
 	}
 
+	// Endgame tables. The root needs a move, so it's always searched.
+	int tbScore;
+
+	if (ply > 0 && probeEGTB(board, &tbScore))
+		return tbScore;
+
 	History history;
+	AttackInfo info;
+
+	// The attacks are shared by the evaluation and the move generation
+	fillAttackInfo(board, &info);
+
+	if (incheck && isCheckmate(board, &info))
+		return finalEval(board, depth);
+
+	const int staticEval = evalWithAttacks(board, &info);
+	frame->staticEval = staticEval;
+
+	// The position has improved since our last move
+	const int improving = !incheck && ply >= 2 && staticEval > (frame - 2)->staticEval;
 
-	const int staticEval = eval(board);
-	const int pvNode = beta - alpha > 1;
 	const int endgame = isEndgame(board);
 	const int safe = !incheck && !endgame;
-	const int verySafe = safe && !nullmove;
+	const int verySafe = safe && !nullmove && !excluded;
 
 	// Razoring
 	if (depth == 1 && safe && staticEval + pieceValues[ROOK] < alpha)
-		return qsearch(board, alpha, beta);
+		return qsearch(board, alpha, beta, 0);
 
 	// Reverse Futility Pruning
 	if (depth <= 4 && staticEval - pieceValues[PAWN] * depth > beta)
@@ -161,28 +444,97 @@ int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove) {
 		static const int R = 3;
 		const int bound = beta;
 
+		// The null move doesn't change the ply, so the previous move is restored after it
+		const Move previous = getPlayedMove(board->ply);
+
 		makeNullMove(board, &history);
-		const int score = -pvSearch(board, depth - R - 1, -bound, -bound + 1, 1);
+		savePlayedMove(NULL, board->ply);
+		const int score = -nonPvSearch(board, depth - R - 1, -bound, -bound + 1, 1);
+		savePlayedMove(&previous, board->ply);
 		undoNullMove(board, &history);
 
 		if (score >= bound)
-			return pvSearch(board, depth - R, alpha, beta, 0);
+			return pvNode ? pvSearch(board, depth - R, alpha, beta, 0) : nonPvSearch(board, depth - R, alpha, beta, 0);
+
+		frame->staticEval = staticEval;
 	}
 
-	Move moves[MAX_MOVES];
-	const int nMoves = legalMoves(board, moves);
+	// ProbCut
+	// A capture that beats beta by a margin in the quiescence search and then
+	// in a reduced search would most likely beat it in the full one too
+	if (!pvNode && !incheck && !excluded && depth >= probCutDepth && abs(beta) < KNOWN_WIN) {
+		const int probCutBeta = beta + probCutMargin;
 
-	if (nMoves == 0)
-		return finalEval(board, depth);
+		Move *moves = frame->moves;
+		const int nMoves = generateMoves(board, &info, moves);
+
+		for (int i = 0; i < nMoves; ++i) {
+			if (moves[i].type != CAPTURE || !seeGreaterOrEqual(board, &moves[i], probCutBeta - staticEval))
+				continue;
+
+			frame->currentMove = moves[i];
+
+			makeMove(board, &moves[i], &history);
+			updateBoardKey(board, &moves[i], &history);
+			savePlayedMove(&moves[i], board->ply);
+			saveKeyToMemory(board->key);
+
+			int score = -qsearch(board, -probCutBeta, -probCutBeta + 1, 0);
+
+			if (score >= probCutBeta)
+				score = -nonPvSearch(board, depth - 4, -probCutBeta, -probCutBeta + 1, nullmove);
+
+			freeKeyFromMemory();
+			updateBoardKey(board, &moves[i], &history);
+			undoMove(board, &moves[i], &history);
+
+			if (score >= probCutBeta)
+				return score;
+		}
+
+		frame->staticEval = staticEval;
+	}
 
 	// IID
+	// It's done before the move generation, as it uses the same frame
 	if (!ttHit && depth >= 7 && pvNode) {
 		pvSearch(board, depth - 2, alpha, beta, nullmove);
+		frame->staticEval = staticEval;
+	}
+
+	// Singular extension
+	// If every move but the TT one fails low against a margin below its score,
+	// the TT move is forced and it gets extended. If some of them still beat
+	// beta, several moves refute the parent and the node is cut (multi-cut).
+	Move singularMove = {.from=0,.to=0};
+
+	if (!excluded && ply > 0 && depth >= SINGULAR_DEPTH && tt[index].key == board->key &&
+		tt[index].flag != UPPER_BOUND && tt[index].depth >= depth - 3 && abs(tt[index].score) < KNOWN_WIN) {
+
+		const Move ttMove = decompressMove(board, &tt[index].move);
+		const int singularBeta = tt[index].score - 2 * depth;
 
-		ASSERT(tt[index].key == board->key);
+		frame->excludedMove = ttMove;
+		const int score = nonPvSearch(board, (depth - 1) / 2, singularBeta - 1, singularBeta, nullmove);
+		frame->excludedMove = (Move){.from=0,.to=0};
+		frame->staticEval = staticEval;
+
+		if (score < singularBeta)
+			singularMove = ttMove;
+		else if (singularBeta >= beta)
+			return singularBeta;
 	}
 
-	sort(board, moves, nMoves);
+	Move *moves = frame->moves;
+	const int nMoves = generateMoves(board, &info, moves);
+
+	if (nMoves == 0)
+		return finalEval(board, depth);
+
+	sort(board, moves, nMoves, frame->killers);
+
+	// The null move and IID searches have used this ply's line
+	frame->pvLength = 0;
 
 	Move bestMove = moves[0];
 	int bestScore = -INFINITY;
@@ -190,52 +542,75 @@ int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove) {
 	const int prevAlpha = alpha;
 	const int newDepth = depth - 1;
 
+	// Moves searched without producing a cutoff
+	Move *quiets = frame->quiets, *captures = frame->captures;
+	int nQuiets = 0, nCaptures = 0;
+
 	static const int fMargins[] = {0, 200, 300, 500};
 	const int fPrunning = depth <= 3 && !incheck && staticEval + fMargins[depth] <= alpha;
 
 	for (int i = 0; i < nMoves; ++i) {
 
+		if (excluded && compareMoves(&moves[i], &excludedMove))
+			continue;
+
 		const int quietMove = moves[i].type == QUIET && !moves[i].promotion;
+		const int extension = compareMoves(&moves[i], &singularMove);
 
 		// Futility Pruning
 		if (!pvNode && fPrunning && quietMove)
 			continue;
 
 		// Late move pruning 
-		// Skip a move when it's score is bad and it has low depth
-		if (newDepth <= 6 && moves[i].score < -10 * depth * depth)
+		// Skip a capture when it loses too much material and it has low depth
+		if (newDepth <= 6 && moves[i].type == CAPTURE && moves[i].score < BAD_CAPTURE_SCORE - 60 - 10 * depth * depth)
+			continue;
+
+		// Move count pruning
+		// The last quiet moves of a shallow node are skipped unless they give check
+		if (!pvNode && !incheck && quietMove && depth <= LMP_DEPTH && i >= moveCountLimits[improving][depth] &&
+			bestScore > -KNOWN_WIN && !givesCheck(board, &info, &moves[i]))
 			continue;
 
+		frame->currentMove = moves[i];
+		frame->reduction = 0;
+
 		makeMove(board, &moves[i], &history);
 		updateBoardKey(board, &moves[i], &history);
+		savePlayedMove(&moves[i], board->ply);
 
 		// The board's key is saved to check for 3fold repetition
 		saveKeyToMemory(board->key);
 
 		int score;
 
-		if (isDraw(board))
+		if (isDraw(board, ply + 1)) {
 			score = 0;
+			(frame + 1)->pvLength = 0;
+		}
 		
 		else if (i == 0)
-			score = -pvSearch(board, newDepth, -beta, -alpha, nullmove);
+			score = pvNode ? -pvSearch(board, newDepth + extension, -beta, -alpha, nullmove)
+						   : -nonPvSearch(board, newDepth + extension, -beta, -alpha, nullmove);
 		
 		else {
-			int reduct = 0;
-
 			// Late move reduction
 			// Only quiet moves (excluding promotions) are reduced
-			if (depth >= 2 && moves[i].score == 0 && !incheck)
-				++reduct;
+			if (quietMove && !incheck)
+				frame->reduction = lateMoveReduction(depth, i, &moves[i], pvNode, improving);
 
 			// PV search
 			// A search with a small window is used to see 
 			// if the move is worth exploring further
-			score = -pvSearch(board, newDepth - reduct, -alpha-1, -alpha, nullmove);
+			score = -nonPvSearch(board, newDepth + extension - frame->reduction, -alpha-1, -alpha, nullmove);
+
+			// A reduced move that beats alpha is verified at full depth first
+			if (score > alpha && frame->reduction)
+				score = -nonPvSearch(board, newDepth + extension, -alpha-1, -alpha, nullmove);
 
 			// Research if the score is worth looking into
-			if (score > alpha)
-				score = -pvSearch(board, newDepth, -beta, -alpha, nullmove);
+			if (pvNode && score > alpha && score < beta)
+				score = -pvSearch(board, newDepth + extension, -beta, -alpha, nullmove);
 		}
 
 		// The board's key is freed from the 3fold repetition list
@@ -244,6 +619,10 @@ int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove) {
 		updateBoardKey(board, &moves[i], &history);
 		undoMove(board, &moves[i], &history);
 
+		// The scores of an interrupted search are meaningless
+		if (settings.stop)
+			return 0;
+
 		// Updates the best move
 		if (score > bestScore) {
 			bestScore = score;
@@ -251,13 +630,18 @@ int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove) {
 
 			if (bestScore > alpha) {
 				alpha = bestScore;
+				updatePV(frame, &moves[i]);
 
 				// AlphaBeta prunning
 				if (alpha >= beta) {
 
 					// Killer moves are moves that produce a cutoff despite being quiet
-					if (moves[i].type == QUIET)
-						saveKillerMove(&moves[i], board->ply);
+					if (moves[i].type == QUIET) {
+						frame->killers[1] = frame->killers[0];
+						frame->killers[0] = moves[i];
+					}
+
+					updateHistory(board, &moves[i], quiets, nQuiets, captures, nCaptures, depth);
 
 					#ifdef DEBUG
 					++stats.betaCutoffs;
@@ -270,6 +654,11 @@ int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove) {
 				}
 			}
 		}
+
+		if (moves[i].type == CAPTURE)
+			captures[nCaptures++] = moves[i];
+		else if (quietMove)
+			quiets[nQuiets++] = moves[i];
 	}
 
 	int flag = EXACT;
@@ -279,38 +668,64 @@ int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove) {
 	else if (bestScore >= beta)
 		flag = LOWER_BOUND;
 
-	// Always replace the entry for the TT
-	tt[index] = compressEntry(board->key, &bestMove, bestScore, depth, flag);
+	// Always replace the entry for the TT, unless a move has been left out
+	if (!excluded)
+		tt[index] = compressEntry(board->key, &bestMove, bestScore, depth, flag);
 
 	return bestScore;
 }
 
-static int qsearch(Board *board, int alpha, int beta) {
+/*
+ * Quiescence search. Only captures and promotions are searched, plus the
+ * quiet moves giving check at its first ply (depth 0). Positions in check
+ * are searched with all their evasions so mates are not missed.
+ */
+static int qsearch(Board *board, int alpha, int beta, const int depth) {
+	if (stopSearch())
+		return 0;
+
 	++stats.nodes;
 
-	const int standPat = eval(board);
+	// King and pawn vs king endings are known exactly
+	int kpkScore;
 
-	if (standPat >= beta)
-		return beta;
+	if (evalKPK(board, &kpkScore))
+		return kpkScore;
 
-	// Delta pruning
-	const int delta = pieceValues[QUEEN];
+	AttackInfo info;
+	fillAttackInfo(board, &info);
 
-	if (standPat + delta < alpha && !isEndgame(board))
-		return alpha;
-	
-	if (standPat > alpha)
-		alpha = standPat;
+	const int incheck = info.checkers != 0;
+	const int standPat = evalWithAttacks(board, &info);
 
-	Move moves[MAX_MOVES];
-	const int nMoves = legalMoves(board, moves);
+	const int ply = board->ply - rootPly;
 
-	if (nMoves == 0)
-		return alpha;
+	if (ply >= MAX_PLY)
+		return standPat;
 
-	sort(board, moves, nMoves);
+	Frame *frame = &stack[ply];
 
-	const int incheck = inCheck(board);
+	if (!incheck) {
+		if (standPat >= beta)
+			return beta;
+
+		// Delta pruning
+		const int delta = pieceValues[QUEEN];
+
+		if (standPat + delta < alpha && !isEndgame(board))
+			return alpha;
+		
+		if (standPat > alpha)
+			alpha = standPat;
+	}
+
+	Move *moves = frame->moves;
+	const int nMoves = generateMoves(board, &info, moves);
+
+	if (nMoves == 0)
+		return incheck ? finalEval(board, depth) : alpha;
+
+	sort(board, moves, nMoves, frame->killers);
 
 	/*
 	* 1. TT move
@@ -318,21 +733,26 @@ static int qsearch(Board *board, int alpha, int beta) {
 	* 3. Promotions
 	* 4. Equal captures
 	* 5. Killer moves
+	* 6. Quiet checks (first ply only)
+	*
+	* Every evasion is searched when in check.
 	*/
 	for (int i = 0; i < nMoves; ++i) {
 
-		if (moves[i].score < 40)
+		if (moves[i].score < KILLER_SCORE - 10 && !incheck)
 			break;
 
 		// Futility pruning
-		if (moves[i].type == CAPTURE && standPat + moves[i].score < alpha && 
-			!incheck && !givesCheck(board, &moves[i]))
+		// Skips the captures that can't bring the score close to alpha
+		if (moves[i].type == CAPTURE && !incheck &&
+			!seeGreaterOrEqual(board, &moves[i], alpha - standPat - 60) && !givesCheck(board, &info, &moves[i]))
 			continue;
 
 		History history;
 
 		makeMove(board, &moves[i], &history);
-		const int score = -qsearch(board, -beta, -alpha);
+		savePlayedMove(&moves[i], board->ply);
+		const int score = -qsearch(board, -beta, -alpha, depth - 1);
 		undoMove(board, &moves[i], &history);
 
 		if (score >= beta) {
@@ -350,32 +770,203 @@ static int qsearch(Board *board, int alpha, int beta) {
 			alpha = score;
 	}
 
+	if (incheck || depth < 0)
+		return alpha;
+
+	// Quiet checks
+	// The quiets list of the frame isn't used by the quiescence search
+	Move *checks = frame->quiets;
+	const int nChecks = generateQuietChecks(board, &info, checks);
+
+	for (int i = 0; i < nChecks; ++i) {
+
+		// Skips the checks that hang the moved piece
+		if (!seeGreaterOrEqual(board, &checks[i], 0))
+			continue;
+
+		// The TT move and the killers have already been searched
+		int searched = 0;
+
+		for (int j = 0; j < nMoves && moves[j].score >= KILLER_SCORE - 10; ++j)
+			searched |= compareMoves(&checks[i], &moves[j]);
+
+		if (searched)
+			continue;
+
+		History history;
+
+		makeMove(board, &checks[i], &history);
+		savePlayedMove(&checks[i], board->ply);
+		const int score = -qsearch(board, -beta, -alpha, depth - 1);
+		undoMove(board, &checks[i], &history);
+
+		if (score >= beta)
+			return beta;
+
+		if (score > alpha)
+			alpha = score;
+	}
+
 	return alpha;
 }
 
 
-static void timeManagement(const Board *board) {
-	if (!settings.movetime) {
-		clock_t remaining, increment;
-
-		if (board->turn == WHITE) {
-			remaining = settings.wtime;
-			increment = settings.winc;
-		} else {
-			remaining = settings.btime;
-			increment = settings.binc;
+/*
+ * The reduction grows with the logarithms of the depth and the move number.
+ * PV nodes and improving positions are reduced less, and so are the quiet
+ * moves with good history. Killers and counter moves, which are scored
+ * above the history range, get one ply less.
+ */
+static int lateMoveReduction(const int depth, const int moveNumber, const Move *move, const int pvNode, const int improving) {
+	int r = reductions[min(depth, MAX_DEPTH)][min(moveNumber, MAX_MOVES - 1)];
+
+	r -= pvNode;
+	r += !improving;
+
+	if (move->score >= COUNTER_MOVE_SCORE)
+		--r;
+	else
+		r -= move->score / HISTORY_MAX;
+
+	// The reduced search never drops into the quiescence search
+	return max(0, min(r, depth - 2));
+}
+
+// Stable insertion sort of the root moves, by score and then by subtree size
+static void sortRootMoves(void) {
+	for (int i = 1; i < nRootMoves; ++i) {
+		const RootMove rootMove = rootMoves[i];
+		int j = i - 1;
+
+		while (j >= 0 && (rootMoves[j].score < rootMove.score ||
+			  (rootMoves[j].score == rootMove.score && rootMoves[j].nodes < rootMove.nodes))) {
+			rootMoves[j + 1] = rootMoves[j];
+			--j;
 		}
 
-		if (settings.movestogo || increment) {
-			if (settings.movestogo && settings.movestogo < 8)
-				settings.movetime = min(remaining >> 1, remaining / (settings.movestogo + 12) + (clock_t)((double) increment * .4));
-			else
-				settings.movetime = min(remaining >> 2, remaining / 27 + (clock_t)((double)increment * .95));
-        } else {
-            settings.movetime = remaining / 41;
-        }
+		rootMoves[j + 1] = rootMove;
 	}
+}
+
+// Sets the move followed by the line of the next ply as the PV of this ply
+static void updatePV(Frame *frame, const Move *move) {
+	const Frame *next = frame + 1;
+
+	frame->pv[0] = *move;
+	memcpy(&frame->pv[1], next->pv, next->pvLength * sizeof(Move));
+	frame->pvLength = next->pvLength + 1;
+}
+
+/*
+ * A fixed movetime is used whole. With a clock, the soft limit is the share
+ * of the remaining time the move should take, and the hard limit lets a
+ * troubled search go on for a few times longer while keeping a safety margin.
+ */
+static void timeManagement(const Board *board) {
+	softLimit = hardLimit = 0;
+
+	if (settings.movetime) {
+		softLimit = hardLimit = max(1, settings.movetime - MOVE_OVERHEAD);
+		return;
+	}
+
+	const long remaining = (board->turn == WHITE) ? settings.wtime : settings.btime;
+	const long increment = (board->turn == WHITE) ? settings.winc  : settings.binc;
+
+	if (remaining <= 0)
+		return;
+
+	if (settings.movestogo || increment) {
+		if (settings.movestogo && settings.movestogo < 8)
+			softLimit = min(remaining >> 1, remaining / (settings.movestogo + 12) + (long)(increment * .4));
+		else
+			softLimit = min(remaining >> 2, remaining / 27 + (long)(increment * .95));
+	} else {
+		softLimit = remaining / 41;
+	}
+
+	const long available = max(1, remaining - MOVE_OVERHEAD);
+
+	// Part of the time is won back by the ponder hits
+	if (ponderEnabled)
+		softLimit += softLimit / 4;
+
+	softLimit = max(1, min(softLimit, available));
+	hardLimit = max(softLimit, min(HARD_LIMIT_RATIO * softLimit, available / 2));
+}
+
+/*
+ * Decides after each iteration whether to start the next one. The soft limit
+ * is stretched while the best move keeps changing or the score drops, and
+ * shrunk once the best move has settled. As the next iteration usually takes
+ * longer than all the previous ones together, it isn't started past half of it.
+ */
+static int outOfTime(const int depth, const int score, const int prevScore) {
+	static const int stabilityScale[6] = {125, 115, 100, 90, 80, 75};
+
+	// A fixed movetime is used until the hard limit, and pondering until the ponderhit
+	if (!softLimit || settings.movetime || settings.ponder || depth < 2)
+		return 0;
+
+	long limit = softLimit * stabilityScale[min(bestMoveStability, 5)] / 100;
+
+	if (score < prevScore)
+		limit += limit * min(prevScore - score, 100) / 200;
+
+	limit = min(limit, hardLimit);
+
+	return currentTime() - clockStart > limit / 2;
+}
+
+/*
+ * Tells if the search has to stop, either because it has been told to or
+ * because the node budget or the hard limit has been reached. The clock is
+ * only read every checkInterval nodes, so the check costs a load and a
+ * decrement. The node budget is checked exactly, so that a node-limited
+ * search doesn't depend on the speed of the machine.
+ */
+static inline int stopSearch(void) {
+	if (atomic_load_explicit(&settings.stop, memory_order_relaxed))
+		return 1;
+
+	if (settings.nodes && stats.nodes >= settings.nodes) {
+		settings.stop = 1;
+		return 1;
+	}
+
+	if (--nodesToCheck > 0)
+		return 0;
+
+	return checkTime();
+}
+
+/*
+ * Reads the clock and recalibrates the interval from the measured speed,
+ * so that it's read about every TIME_CHECK_MS milliseconds whatever the
+ * hardware. The time past the hard limit is then bounded by that period.
+ */
+static int checkTime(void) {
+	const long elapsed = currentTime() - startTime;
+
+	if (elapsed > 0)
+		checkInterval = (int) max(MIN_CHECK_INTERVAL, min(MAX_CHECK_INTERVAL, stats.nodes * TIME_CHECK_MS / elapsed));
+
+	nodesToCheck = checkInterval;
+
+	if (hardLimit && !settings.ponder && currentTime() - clockStart >= hardLimit) {
+		settings.stop = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+// Monotonic wall clock time in milliseconds, unaffected by the number of threads
+long currentTime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	settings.movetime *= CLOCKS_PER_SEC / 1000;
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
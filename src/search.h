@@ -2,8 +2,26 @@
 #define SRC_SEARCH_H_
 
 #define MAX_DEPTH 63
+#define MAX_PLY 128
+
+#define LMP_DEPTH 7
+#define SINGULAR_DEPTH 8
+
+#define PROBCUT_MARGIN 100
+#define PROBCUT_DEPTH 5
 #define DEF_DEPTH 5
 
+// Time management, in milliseconds
+#define MOVE_OVERHEAD 10
+#define HARD_LIMIT_RATIO 5
+
+// The clock is read about every TIME_CHECK_MS, within these node intervals
+#define TIME_CHECK_MS 1
+#define MIN_CHECK_INTERVAL 256
+#define MAX_CHECK_INTERVAL 65536
+
+// Takes the place of the floating point infinity of math.h
+#undef INFINITY
 #define INFINITY 2 * MAX_SCORE
 
 enum {EXACT, UPPER_BOUND, LOWER_BOUND};
@@ -17,8 +35,48 @@ typedef struct {
 	int ttHits;
 } Stats;
 
+/*
+ * Record of a ply of the search. Each search thread owns a preallocated
+ * stack of them, so the move lists don't live in the C stack.
+ */
+typedef struct {
+	Move moves[MAX_MOVES];
+	Move quiets[MAX_MOVES];		// Searched without producing a cutoff
+	Move captures[MAX_MOVES];
+
+	int staticEval;
+
+	Move killers[2];
+	Move currentMove;
+	Move excludedMove;			// Left out by the singular extension search
+	int reduction;
+
+	Move pv[MAX_PLY];			// Triangular PV, built from the next ply's line
+	int pvLength;
+} Frame;
+
+typedef struct {
+	Move move;
+
+	int score;			// Exact only for the moves that raised alpha
+	uint64_t nodes;		// Size of the subtree in the last search
+} RootMove;
+
+extern int probCutMargin;
+extern int probCutDepth;
+
+extern int ponderEnabled;
+
+void initReductions(void);
+
 Move search(Board *board);
 
+int getPonderMove(Move *move);
+void ponderhit(void);
+
+long currentTime(void);
+
 int pvSearch(Board *board, int depth, int alpha, int beta, const int nullmove);
+int nonPvSearch(Board *board, int depth, int alpha, int beta, const int nullmove);
 
 #endif /* SRC_SEARCH_H_ */
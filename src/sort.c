@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "board.h"
 #include "play.h"
 #include "eval.h"
@@ -5,12 +7,35 @@
 #include "hashtables.h"
 #include "sort.h"
 #include "draw.h"
+#include "magic.h"
+#include "pawns.h"
+
+static uint64_t attackersTo(const Board *board, const int sqr, const uint64_t occupied);
+static int smallestAttacker(const Board *board, const uint64_t ours, uint64_t *occupied, uint64_t *attackers, const int sqr);
 
-static int seePromotion(Board *board, const Move *move);
+static inline int isEnPassant(const Board *board, const Move *move) {
+	return move->piece == PAWN && board->enPassant && move->to == board->enPassant;
+}
 
 static void insertionSort(Move *list, const int n);
 
-static Move killerMoves[MAX_GAME_LENGTH][2];
+static int capturedPiece(const Board *board, const Move *move);
+static inline void updateEntry(int *entry, const int bonus);
+
+/*
+ * Quiet moves are ordered by how often they have produced a cutoff:
+ *  - history: by color, origin and destination (butterfly boards)
+ *  - continuationHistory: by the previous move and the current one
+ *  - counterMoves: the last move that refuted the previous one
+ * Captures with the same exchange value are ordered by captureHistory.
+ */
+static int history[2][64][64];
+static int captureHistory[6][64][6];
+static int continuationHistory[2][6][64][6][64];
+static Move counterMoves[2][6][64];
+
+// Moves that led to each ply of the current line
+static Move playedMoves[MAX_GAME_LENGTH];
 
 /*
  * 1. TT move
@@ -18,108 +43,231 @@ static Move killerMoves[MAX_GAME_LENGTH][2];
  * 3. Promotions
  * 4. Equal captures
  * 5. Killer moves
- * 6. Quiet moves
- * 7. Bad captures
+ * 6. Counter move
+ * 7. Quiet moves
+ * 8. Bad captures
  */
-void sort(Board *board, Move *moves, const int nMoves) {
+void sort(Board *board, Move *moves, const int nMoves, const Move *killers) {
 
 	const int index = board->key % settings.tt_entries;
 	Move pvMove = decompressMove(board, &tt[index].move);
 
+	const Move *previous = &playedMoves[board->ply];
+	const int hasPrevious = previous->from != previous->to;
+
 	for (int i = 0; i < nMoves; ++i) {
 		if (board->key == tt[index].key && compareMoves(&pvMove, &moves[i]))
 			moves[i].score = INFINITY;
 
-		else if (moves[i].type == CAPTURE)
-			moves[i].score = 60 + seeCapture(board, &moves[i]);
+		else if (moves[i].type == CAPTURE) {
+			const int see = seeCapture(board, &moves[i]);
+			const int bonus = captureHistory[moves[i].piece][moves[i].to][capturedPiece(board, &moves[i])] / CAPTURE_HISTORY_SCALE;
+
+			moves[i].score = ((see >= 0) ? CAPTURE_SCORE : BAD_CAPTURE_SCORE) + see + bonus;
+		}
 		
 		else if (moves[i].promotion)
-			moves[i].score = 65;
+			moves[i].score = CAPTURE_SCORE + 5;
 		
+		else if (compareMoves(&moves[i], &killers[0]))
+			moves[i].score = KILLER_SCORE;
+
+		else if (compareMoves(&moves[i], &killers[1]))
+			moves[i].score = KILLER_SCORE - 10;
+
+		else if (hasPrevious && compareMoves(&moves[i], &counterMoves[previous->color][previous->piece][previous->to]))
+			moves[i].score = COUNTER_MOVE_SCORE;
+
 		else {
+			moves[i].score = history[moves[i].color][moves[i].from][moves[i].to];
 
-			if (compareMoves(&moves[i], &killerMoves[board->ply][0]))
-				moves[i].score = 50;
-			else if (compareMoves(&moves[i], &killerMoves[board->ply][1]))
-				moves[i].score = 45;
+			if (hasPrevious)
+				moves[i].score += continuationHistory[previous->color][previous->piece][previous->to][moves[i].piece][moves[i].to];
 		}
 	}
 
 	insertionSort(moves, nMoves);
 }
 
-void sortAB(Board *board, Move *moves, const int nMoves, const int depth, const int alpha, const int beta, const int nullmove) {
+// Forgets the move ordering of previous games, so that searches can be reproduced
+void clearHistory(void) {
+	memset(history, 0, sizeof(history));
+	memset(captureHistory, 0, sizeof(captureHistory));
+	memset(continuationHistory, 0, sizeof(continuationHistory));
+	memset(counterMoves, 0, sizeof(counterMoves));
+}
 
-	for (int i = 0; i < nMoves; ++i) {
+/*
+ * Halves the history tables between searches, so that old information
+ * is kept but the current position quickly takes over.
+ */
+void ageHistory(void) {
+	for (int i = 0; i < 2 * 64 * 64; ++i)
+		(&history[0][0][0])[i] /= 2;
 
-		History history;
+	for (int i = 0; i < 6 * 64 * 6; ++i)
+		(&captureHistory[0][0][0])[i] /= 2;
 
-		makeMove(board, &moves[i], &history);
+	for (int i = 0; i < 2 * 6 * 64 * 6 * 64; ++i)
+		(&continuationHistory[0][0][0][0][0])[i] /= 2;
 
-		if (isDraw(board))
-			moves[i].score = 0;
-		else
-			moves[i].score = -pvSearch(board, depth, -beta, -alpha, nullmove);
-		
-		undoMove(board, &moves[i], &history);
-	}
+	for (int i = 0; i < MAX_GAME_LENGTH; ++i)
+		playedMoves[i] = (Move){.from=0,.to=0};
+}
 
-	insertionSort(moves, nMoves);
+/*
+ * Stores the move that leads to the given ply.
+ * A null move is stored when move is NULL.
+ */
+void savePlayedMove(const Move *move, const int ply) {
+	playedMoves[ply] = (move) ? *move : (Move){.from=0,.to=0};
+}
+
+Move getPlayedMove(const int ply) {
+	return playedMoves[ply];
 }
 
-void initKillerMoves(void) {
-	const Move nullMove = (Move){.from=0,.to=0};
+/*
+ * Rewards the move that produced a cutoff and penalizes the moves
+ * of the same kind that were searched before it without success.
+ */
+void updateHistory(const Board *board, const Move *best, const Move *quiets, const int nQuiets,
+		const Move *captures, const int nCaptures, const int depth) {
+
+	const int bonus = min(depth * depth, HISTORY_MAX / 8);
+
+	if (best->type == CAPTURE) {
+		updateEntry(&captureHistory[best->piece][best->to][capturedPiece(board, best)], bonus);
+	} else {
+		const Move *previous = &playedMoves[board->ply];
+		const int hasPrevious = previous->from != previous->to;
+
+		updateEntry(&history[best->color][best->from][best->to], bonus);
+
+		if (hasPrevious) {
+			counterMoves[previous->color][previous->piece][previous->to] = *best;
+			updateEntry(&continuationHistory[previous->color][previous->piece][previous->to][best->piece][best->to], bonus);
+		}
+
+		for (int i = 0; i < nQuiets; ++i) {
+			updateEntry(&history[quiets[i].color][quiets[i].from][quiets[i].to], -bonus);
 
-	for (int i = 0; i < MAX_GAME_LENGTH; ++i) {
-		killerMoves[i][0] = nullMove;
-		killerMoves[i][1] = nullMove;
+			if (hasPrevious)
+				updateEntry(&continuationHistory[previous->color][previous->piece][previous->to][quiets[i].piece][quiets[i].to], -bonus);
+		}
 	}
+
+	for (int i = 0; i < nCaptures; ++i)
+		updateEntry(&captureHistory[captures[i].piece][captures[i].to][capturedPiece(board, &captures[i])], -bonus);
 }
 
-void saveKillerMove(const Move *move, const int ply) {
-	killerMoves[ply][1] = killerMoves[ply][0];
-	killerMoves[ply][0] = *move;
+/*
+ * Static exchange evaluation of a move with a swap list.
+ * The pieces that capture are removed from the occupancy, which reveals
+ * the sliders behind them, so the board is never modified.
+ */
+int seeCapture(const Board *board, const Move *move) {
+	int gain[32], d = 0;
+
+	const int to = move->to;
+
+	uint64_t occupied = board->occupied ^ bitmask[move->from];
+	int captured = findPiece(board, bitmask[to], board->opponent);
+
+	if (isEnPassant(board, move)) {
+		captured = PAWN;
+		occupied ^= bitmask[to - 8 + 16 * board->turn];
+	}
+
+	uint64_t attackers = attackersTo(board, to, occupied) & occupied;
+
+	int piece = move->piece;
+	int color = board->turn;
+
+	gain[0] = (captured >= 0) ? pieceValues[captured] : 0;
+
+	if (move->promotion) {
+		piece = move->promotion;
+		gain[0] += pieceValues[piece] - pieceValues[PAWN];
+	}
+
+	do {
+		++d;
+		gain[d] = pieceValues[piece] - gain[d-1];
+
+		color ^= 1;
+		piece = smallestAttacker(board, attackers & board->players[color], &occupied, &attackers, to);
+
+		// The king can only capture if the square isn't defended anymore
+		if (piece == KING && (attackers & board->players[1 ^ color]))
+			break;
+	} while (piece >= 0 && d < 31);
+
+	while (--d)
+		gain[d-1] = -max(-gain[d-1], gain[d]);
+
+	return gain[0];
 }
 
-int see(Board *board, const int sqr) {
-	const int from = getSmallestAttacker(board, sqr, board->turn);
+/*
+ * Returns whether the exchange started by the move wins at least the threshold.
+ * It stops as soon as the result is known, so it's cheaper than the full value.
+ */
+int seeGreaterOrEqual(const Board *board, const Move *move, const int threshold) {
+	const int to = move->to;
+
+	uint64_t occupied = board->occupied ^ bitmask[move->from];
+	int captured = findPiece(board, bitmask[to], board->opponent);
 
-	// Return if the square isn't attacked by more pieces
-	if (from == -1)
+	if (isEnPassant(board, move)) {
+		captured = PAWN;
+		occupied ^= bitmask[to - 8 + 16 * board->turn];
+	}
+
+	int swap = ((captured >= 0) ? pieceValues[captured] : 0) - threshold;
+	int piece = move->piece;
+
+	if (move->promotion) {
+		piece = move->promotion;
+		swap += pieceValues[piece] - pieceValues[PAWN];
+	}
+
+	if (swap < 0)
 		return 0;
 
-	int value = 0;
+	// Even if the piece is lost the threshold is reached
+	swap = pieceValues[piece] - swap;
 
-	const int attacker = findPiece(board, bitmask[from], board->turn);
-	const int pieceCaptured = findPiece(board, bitmask[sqr], board->opponent);
+	if (swap <= 0)
+		return 1;
 
-	ASSERT(attacker >= 0 && pieceCaptured >= 0);
+	uint64_t attackers = attackersTo(board, to, occupied) & occupied;
 
-	const int promotion = (attacker == PAWN && (sqr < 8 || sqr >= 56)) ? QUEEN : 0;
-	const Move move = (Move){.to=sqr, .from=from, .piece=attacker, .color=board->turn, .type=CAPTURE, .castle=-1, .promotion=promotion};
+	int color = board->turn, result = 1;
 
-	History history;
+	while (1) {
+		color ^= 1;
 
-	makeMove(board, &move, &history);
-	const int score = pieceValues[pieceCaptured] - see(board, sqr);
-	value = max(score, 0);
-	undoMove(board, &move, &history);
+		const uint64_t ours = attackers & board->players[color];
 
-	return value;
-}
+		if (!ours)
+			break;
 
-int seeCapture(Board *board, const Move *move) {
-	ASSERT(move->type == CAPTURE);
+		result ^= 1;
 
-	History history;
+		piece = smallestAttacker(board, ours, &occupied, &attackers, to);
 
-	const int pieceCaptured = findPiece(board, bitmask[move->to], board->opponent);
+		// The king can only capture if the square isn't defended anymore
+		if (piece == KING)
+			return (attackers & board->players[1 ^ color]) ? result ^ 1 : result;
 
-	makeMove(board, move, &history);
-	const int value = pieceValues[pieceCaptured] - see(board, move->to);
-	undoMove(board, move, &history);
+		swap = pieceValues[piece] - swap;
 
-	return value;
+		if (swap < result)
+			break;
+	}
+
+	return result;
 }
 
 // Orders a list of moves by their score using insertion sort
@@ -136,3 +284,66 @@ static void insertionSort(Move *list, const int n) {
 		list[j+1] = move;
 	}
 }
+
+/*
+ * Pieces of both sides that attack the square with the given occupancy.
+ */
+static uint64_t attackersTo(const Board *board, const int sqr, const uint64_t occupied) {
+	const uint64_t bishops = board->pieces[WHITE][BISHOP] | board->pieces[BLACK][BISHOP] |
+			board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN];
+	const uint64_t rooks = board->pieces[WHITE][ROOK] | board->pieces[BLACK][ROOK] |
+			board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN];
+
+	return (pawnAttacksLookup[BLACK][sqr] & board->pieces[WHITE][PAWN]) |
+		   (pawnAttacksLookup[WHITE][sqr] & board->pieces[BLACK][PAWN]) |
+		   (knightLookup[sqr] & (board->pieces[WHITE][KNIGHT] | board->pieces[BLACK][KNIGHT])) |
+		   (kingLookup[sqr] & (board->pieces[WHITE][KING] | board->pieces[BLACK][KING])) |
+		   (bishopAttacks(sqr, occupied) & bishops) |
+		   (rookAttacks(sqr, occupied) & rooks);
+}
+
+/*
+ * Removes the least valuable of our attackers from the occupancy and adds
+ * the sliders it was hiding. Returns its type, or -1 if there's none.
+ */
+static int smallestAttacker(const Board *board, const uint64_t ours, uint64_t *occupied, uint64_t *attackers, const int sqr) {
+	if (!ours)
+		return -1;
+
+	const int color = (ours & board->players[WHITE]) ? WHITE : BLACK;
+
+	for (int piece = PAWN; piece <= KING; ++piece) {
+		const uint64_t bb = ours & board->pieces[color][piece];
+
+		if (!bb)
+			continue;
+
+		*occupied ^= lsbBB(bb);
+
+		if (piece == PAWN || piece == BISHOP || piece == QUEEN)
+			*attackers |= bishopAttacks(sqr, *occupied) & (board->pieces[WHITE][BISHOP] |
+					board->pieces[BLACK][BISHOP] | board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN]);
+
+		if (piece == ROOK || piece == QUEEN)
+			*attackers |= rookAttacks(sqr, *occupied) & (board->pieces[WHITE][ROOK] |
+					board->pieces[BLACK][ROOK] | board->pieces[WHITE][QUEEN] | board->pieces[BLACK][QUEEN]);
+
+		*attackers &= *occupied;
+
+		return piece;
+	}
+
+	return -1;
+}
+
+static int capturedPiece(const Board *board, const Move *move) {
+	return isEnPassant(board, move) ? PAWN : findPiece(board, bitmask[move->to], board->opponent);
+}
+
+/*
+ * The entries saturate at HISTORY_MAX: the bigger an entry is,
+ * the less a new bonus in the same direction moves it.
+ */
+static inline void updateEntry(int *entry, const int bonus) {
+	*entry += bonus - *entry * abs(bonus) / HISTORY_MAX;
+}
@@ -8,13 +8,25 @@
 #ifndef SRC_SORT_H_
 #define SRC_SORT_H_
 
-void sort(Board *board, Move *moves, const int nMoves);
-void sortAB(Board *board, Move *moves, const int nMoves, const int depth, const int alpha, const int beta, const int nullmove);
+#define HISTORY_MAX 4096
+#define CAPTURE_HISTORY_SCALE 64
 
-void initKillerMoves(void);
-void saveKillerMove(const Move *move, const int ply);
+// Move ordering scores, the TT move gets INFINITY
+#define CAPTURE_SCORE 10000
+#define KILLER_SCORE 9000
+#define COUNTER_MOVE_SCORE 8980
+#define BAD_CAPTURE_SCORE -10000
 
-int see(Board *board, const int sqr);
-int seeCapture(Board *board, const Move *move);
+void sort(Board *board, Move *moves, const int nMoves, const Move *killers);
+
+void clearHistory(void);
+void ageHistory(void);
+void savePlayedMove(const Move *move, const int ply);
+Move getPlayedMove(const int ply);
+void updateHistory(const Board *board, const Move *best, const Move *quiets, const int nQuiets,
+		const Move *captures, const int nCaptures, const int depth);
+
+int seeCapture(const Board *board, const Move *move);
+int seeGreaterOrEqual(const Board *board, const Move *move, const int threshold);
 
 #endif /* SRC_SORT_H_ */
@@ -8,6 +8,7 @@
 #include "uci.h"
 #include "sort.h"
 #include "hashtables.h"
+#include "eval.h"
 
 
 void testMakeMove(char *fen) {
@@ -167,7 +168,7 @@ void testSearch(Board *board, const int depth) {
 
 		int score;
 
-		if (isDraw(board))
+		if (isDraw(board, 1))
 			score = 0;
 		else
 			score = -pvSearch(board, depth, -2 * MAX_SCORE, 2 * MAX_SCORE, 0);
@@ -259,6 +260,41 @@ void testSee(void) {
 	const int score = seeCapture(board, &move);
 
 	printf("SEE score is: %d\n", score);
+	printf("SEE >= 0: %d, SEE >= %d: %d\n", seeGreaterOrEqual(board, &move, 0),
+			score + 1, seeGreaterOrEqual(board, &move, score + 1));
+
+	free(board);
+}
+
+void testKPK(void) {
+	static char *fens[] = {
+		"4k3/8/4K3/4P3/8/8/8/8 w - -",
+		"4k3/8/4K3/4P3/8/8/8/8 b - -",
+		"8/8/8/8/8/8/4P3/4K2k w - -",
+		"4k3/4P3/4K3/8/8/8/8/8 b - -",
+		"4k3/4P3/4K3/8/8/8/8/8 w - -",
+		"k7/8/8/8/8/8/P7/K7 w - -",
+		"k7/p7/8/8/8/8/8/K7 b - -",
+		"8/8/8/8/4p3/4k3/8/4K3 w - -"
+	};
+
+	static const int wins[] = {1, 1, 1, 0, 1, 0, 0, 1};
+
+	Board *board = malloc(sizeof(Board));
+
+	fprintf(stdout, "\n");
+
+	for (unsigned i = 0; i < sizeof(wins) / sizeof(wins[0]); ++i) {
+		int score;
+
+		fenToBoard(board, fens[i]);
+		evalKPK(board, &score);
+
+		fprintf(stdout, "%s  %s \t %d\n", ((score != 0) == wins[i]) ? "PASS" : "FAIL", fens[i], score);
+	}
+
+	fprintf(stdout, "\n");
+	fflush(stdout);
 
 	free(board);
 }
@@ -16,4 +16,6 @@ void testPosition(char* fen, const int depth);
 
 void testSee(void);
 
+void testKPK(void);
+
 #endif
@@ -0,0 +1,615 @@
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "board.h"
+#include "play.h"
+#include "eval.h"
+#include "draw.h"
+#include "tune.h"
+
+/*
+ * Texel tuning of the evaluation parameters.
+ *
+ * Every position of the dataset is resolved with a quiescence search, and the
+ * quiet position it leads to is stored as the list of features it contains:
+ * material, piece-square and mobility counts. The evaluation is linear on the
+ * parameters of those features, so the gradient of the logistic loss can be
+ * computed exactly. Terms that aren't tuned are kept as a constant offset.
+ *
+ * Each line of the dataset must start with a fen and contain the result
+ * of the game, either as "1-0", "0-1", "1/2-1/2" or as [1.0], [0.5], [0.0].
+ */
+
+#define BATCH_SIZE 65536
+#define MAX_FEATURES 128
+
+#define PST_FEATURE(piece, sqr) (6 + 64 * (piece) + (sqr))
+#define MOBILITY_FEATURE(piece) (6 + 64 * 6 + (piece))
+#define N_FEATURES (6 + 64 * 6 + 6)
+
+#define LEARNING_RATE 1.0
+#define BETA1 0.9
+#define BETA2 0.999
+
+typedef struct {
+	uint16_t index;
+	int16_t value;
+} Feature;
+
+typedef struct {
+	double result;		// 1 for a white win, 0.5 for a draw and 0 for a black win
+	double offset;		// Part of the evaluation that isn't being tuned
+	int phase;
+
+	uint64_t start;		// Index of its first feature
+	int count;
+} Sample;
+
+typedef struct {
+	Board *boards;
+	double *results;
+
+	int start;
+	int end;
+
+	Sample *samples;
+	Feature *features;
+
+	int nSamples;
+	uint64_t nFeatures;
+} Resolver;
+
+typedef struct {
+	uint64_t start;
+	uint64_t end;
+
+	double k;
+	int needGradient;
+
+	double loss;
+	double gradient[PHASES][N_FEATURES];
+} Worker;
+
+static Sample *samples;
+static Feature *features;
+
+static uint64_t nSamples, nFeatures;
+static uint64_t samplesCapacity, featuresCapacity;
+
+static double params[PHASES][N_FEATURES];
+
+static void loadParameters(void);
+static void storeParameters(void);
+static void exportParameters(const char *filename);
+
+static uint64_t loadDataset(const char *filename, const int threads);
+static int parseResult(const char *line, double *result);
+static void resolveBatch(Board *boards, double *results, const int n, const int threads);
+static void *resolveRange(void *args);
+static int quiescence(Board *board, int alpha, int beta, Board *leaf);
+static int extractFeatures(const Board *board, const AttackInfo *info, Feature *list);
+
+static double evalSample(const Sample *sample, const Feature *f);
+static double computeLoss(const double k, const int threads, double gradient[PHASES][N_FEATURES]);
+static void *lossRange(void *args);
+static double bestScalingFactor(const int threads);
+
+static inline double sigmoid(const double k, const double score) {
+	return 1.0 / (1.0 + pow(10.0, -k * score / 400.0));
+}
+
+void tune(const char *filename, const int threads, const int epochs) {
+	static double gradient[PHASES][N_FEATURES];
+	static double m[PHASES][N_FEATURES], v[PHASES][N_FEATURES];
+
+	loadParameters();
+
+	if (loadDataset(filename, threads) == 0) {
+		fprintf(stdout, "No positions could be loaded from %s\n", filename);
+		fflush(stdout);
+		return;
+	}
+
+	const double k = bestScalingFactor(threads);
+
+	fprintf(stdout, "Loaded %" PRIu64 " positions, K = %.4f\n", nSamples, k);
+	fflush(stdout);
+
+	memset(m, 0, sizeof(m));
+	memset(v, 0, sizeof(v));
+
+	// Adam optimizer over the full dataset
+	for (int epoch = 1; epoch <= epochs; ++epoch) {
+		const double loss = computeLoss(k, threads, gradient);
+
+		const double correction1 = 1 - pow(BETA1, epoch);
+		const double correction2 = 1 - pow(BETA2, epoch);
+
+		for (int phase = 0; phase < PHASES; ++phase) {
+			for (int i = 0; i < N_FEATURES; ++i) {
+				const double g = gradient[phase][i];
+
+				m[phase][i] = BETA1 * m[phase][i] + (1 - BETA1) * g;
+				v[phase][i] = BETA2 * v[phase][i] + (1 - BETA2) * g * g;
+
+				params[phase][i] -= LEARNING_RATE * (m[phase][i] / correction1) /
+						(sqrt(v[phase][i] / correction2) + 1e-8);
+			}
+		}
+
+		if (epoch % 10 == 0 || epoch == epochs) {
+			fprintf(stdout, "Epoch %d loss %.6f\n", epoch, loss);
+			fflush(stdout);
+		}
+	}
+
+	storeParameters();
+	exportParameters(TUNE_OUTPUT);
+
+	fprintf(stdout, "Parameters saved to %s\n", TUNE_OUTPUT);
+	fflush(stdout);
+
+	free(samples);
+	free(features);
+
+	samples = NULL;
+	features = NULL;
+	nSamples = nFeatures = samplesCapacity = featuresCapacity = 0;
+}
+
+// AUX
+
+static void loadParameters(void) {
+	memset(params, 0, sizeof(params));
+
+	for (int piece = PAWN; piece <= QUEEN; ++piece)
+		params[OPENING][piece] = pieceValues[piece];
+
+	for (int phase = 0; phase < PHASES; ++phase) {
+		for (int piece = PAWN; piece <= KING; ++piece) {
+			for (int sqr = 0; sqr < 64; ++sqr)
+				params[phase][PST_FEATURE(piece, sqr)] = pst[phase][piece][sqr];
+
+			params[phase][MOBILITY_FEATURE(piece)] = mobilityWeights[phase][piece];
+		}
+	}
+}
+
+/*
+ * Copies the tuned parameters back into the evaluation.
+ */
+static void storeParameters(void) {
+	for (int piece = PAWN; piece <= QUEEN; ++piece)
+		pieceValues[piece] = (int) lround(params[OPENING][piece]);
+
+	for (int phase = 0; phase < PHASES; ++phase) {
+		for (int piece = PAWN; piece <= KING; ++piece) {
+			for (int sqr = 0; sqr < 64; ++sqr)
+				pst[phase][piece][sqr] = (int) lround(params[phase][PST_FEATURE(piece, sqr)]);
+
+			mobilityWeights[phase][piece] = (int) lround(params[phase][MOBILITY_FEATURE(piece)]);
+		}
+	}
+}
+
+/*
+ * Writes the parameters with the same layout they have in eval.c.
+ */
+static void exportParameters(const char *filename) {
+	FILE *fp = fopen(filename, "w");
+
+	if (fp == NULL) {
+		fprintf(stdout, "There was an error opening the file %s\n", filename);
+		return;
+	}
+
+	fprintf(fp, "int pieceValues[6] = {");
+
+	for (int piece = PAWN; piece <= KING; ++piece)
+		fprintf(fp, "%d%s", pieceValues[piece], (piece < KING) ? ", " : "};\n\n");
+
+	fprintf(fp, "int pst[PHASES][6][64] = {\n");
+
+	for (int phase = 0; phase < PHASES; ++phase) {
+		fprintf(fp, "{\n");
+
+		for (int piece = PAWN; piece <= KING; ++piece) {
+			fprintf(fp, "\t{ ");
+
+			for (int sqr = 0; sqr < 64; ++sqr)
+				fprintf(fp, "%d%s", pst[phase][piece][sqr], (sqr < 63) ? ", " : " }");
+
+			fprintf(fp, "%s\n", (piece < KING) ? "," : "");
+		}
+
+		fprintf(fp, "%s", (phase < PHASES - 1) ? "},\n" : "}};\n\n");
+	}
+
+	fprintf(fp, "int mobilityWeights[PHASES][6] = {\n");
+
+	for (int phase = 0; phase < PHASES; ++phase) {
+		fprintf(fp, "\t{");
+
+		for (int piece = PAWN; piece <= KING; ++piece)
+			fprintf(fp, "%d%s", mobilityWeights[phase][piece], (piece < KING) ? ", " : "}");
+
+		fprintf(fp, "%s\n", (phase < PHASES - 1) ? "," : "");
+	}
+
+	fprintf(fp, "};\n");
+
+	fclose(fp);
+}
+
+/*
+ * The file is read in batches, which are parsed on the main thread
+ * and resolved in parallel.
+ */
+static uint64_t loadDataset(const char *filename, const int threads) {
+	FILE *fp = fopen(filename, "r");
+
+	if (fp == NULL) {
+		fprintf(stdout, "There was an error opening the file %s\n", filename);
+		return 0;
+	}
+
+	Board *boards = malloc(BATCH_SIZE * sizeof(Board));
+	double *results = malloc(BATCH_SIZE * sizeof(double));
+
+	char line[512];
+	int n = 0;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (!parseResult(line, &results[n]))
+			continue;
+
+		fenToBoard(&boards[n], line);
+		clearKeys();
+
+		if (++n == BATCH_SIZE) {
+			resolveBatch(boards, results, n, threads);
+			n = 0;
+		}
+	}
+
+	resolveBatch(boards, results, n, threads);
+
+	free(boards);
+	free(results);
+	fclose(fp);
+
+	return nSamples;
+}
+
+static int parseResult(const char *line, double *result) {
+	const char *bracket;
+
+	if (strstr(line, "1/2-1/2"))
+		*result = 0.5;
+	else if (strstr(line, "1-0"))
+		*result = 1.0;
+	else if (strstr(line, "0-1"))
+		*result = 0.0;
+	else if ((bracket = strchr(line, '[')) != NULL)
+		*result = atof(bracket + 1);
+	else
+		return 0;
+
+	return 1;
+}
+
+static void resolveBatch(Board *boards, double *results, const int n, const int threads) {
+	pthread_t workers[threads];
+	Resolver args[threads];
+
+	const int chunk = n / threads + 1;
+
+	for (int i = 0; i < threads; ++i) {
+		args[i] = (Resolver){
+			.boards = boards,
+			.results = results,
+			.start = min(i * chunk, n),
+			.end = min((i + 1) * chunk, n),
+			.samples = malloc(chunk * sizeof(Sample)),
+			.features = malloc(chunk * MAX_FEATURES * sizeof(Feature))
+		};
+
+		pthread_create(&workers[i], NULL, resolveRange, &args[i]);
+	}
+
+	for (int i = 0; i < threads; ++i) {
+		pthread_join(workers[i], NULL);
+
+		if (nSamples + args[i].nSamples > samplesCapacity) {
+			samplesCapacity = 2 * (nSamples + args[i].nSamples);
+			samples = realloc(samples, samplesCapacity * sizeof(Sample));
+		}
+
+		if (nFeatures + args[i].nFeatures > featuresCapacity) {
+			featuresCapacity = 2 * (nFeatures + args[i].nFeatures);
+			features = realloc(features, featuresCapacity * sizeof(Feature));
+		}
+
+		for (int j = 0; j < args[i].nSamples; ++j) {
+			samples[nSamples] = args[i].samples[j];
+			samples[nSamples].start += nFeatures;
+			++nSamples;
+		}
+
+		memcpy(features + nFeatures, args[i].features, args[i].nFeatures * sizeof(Feature));
+		nFeatures += args[i].nFeatures;
+
+		free(args[i].samples);
+		free(args[i].features);
+	}
+}
+
+/*
+ * Finds the quiet position behind each board and stores its features.
+ * Positions that end in check or that are scored by a specialized
+ * endgame evaluation are skipped.
+ */
+static void *resolveRange(void *args) {
+	Resolver *resolver = (Resolver *) args;
+
+	for (int i = resolver->start; i < resolver->end; ++i) {
+		Board leaf;
+		AttackInfo info;
+
+		quiescence(&resolver->boards[i], -2 * MAX_SCORE, 2 * MAX_SCORE, &leaf);
+
+		if (popCount(leaf.players[WHITE]) == 1 || popCount(leaf.players[BLACK]) == 1)
+			continue;
+
+		fillAttackInfo(&leaf, &info);
+
+		if (info.checkers)
+			continue;
+
+		Sample *sample = &resolver->samples[resolver->nSamples++];
+
+		sample->result = resolver->results[i];
+		sample->phase = gamePhase(&leaf);
+		sample->start = resolver->nFeatures;
+		sample->count = extractFeatures(&leaf, &info, resolver->features + resolver->nFeatures);
+		sample->offset = 0;
+
+		resolver->nFeatures += sample->count;
+
+		const int score = evalWithAttacks(&leaf, &info);
+		sample->offset = ((leaf.turn == WHITE) ? score : -score) - evalSample(sample, resolver->features + sample->start);
+	}
+
+	return NULL;
+}
+
+/*
+ * A capture-only search that keeps track of the position
+ * the principal variation ends in.
+ */
+static int quiescence(Board *board, int alpha, int beta, Board *leaf) {
+	AttackInfo info;
+	fillAttackInfo(board, &info);
+
+	*leaf = *board;
+
+	const int standPat = evalWithAttacks(board, &info);
+
+	if (standPat >= beta)
+		return beta;
+
+	if (standPat > alpha)
+		alpha = standPat;
+
+	Move moves[MAX_MOVES];
+	int nMoves = generateMoves(board, &info, moves);
+	int nCaptures = 0;
+
+	// Most valuable victim, least valuable attacker
+	for (int i = 0; i < nMoves; ++i) {
+		if (moves[i].type != CAPTURE)
+			continue;
+
+		int victim = PAWN;
+
+		for (int piece = KNIGHT; piece < KING; ++piece) {
+			if (board->pieces[board->opponent][piece] & bitmask[moves[i].to])
+				victim = piece;
+		}
+
+		moves[nCaptures] = moves[i];
+		moves[nCaptures++].score = 8 * victim - moves[i].piece;
+	}
+
+	for (int i = 0; i < nCaptures; ++i) {
+		for (int j = i + 1; j < nCaptures; ++j) {
+			if (moves[j].score > moves[i].score) {
+				const Move tmp = moves[i];
+				moves[i] = moves[j];
+				moves[j] = tmp;
+			}
+		}
+
+		History history;
+		Board childLeaf;
+
+		makeMove(board, &moves[i], &history);
+		const int score = -quiescence(board, -beta, -alpha, &childLeaf);
+		undoMove(board, &moves[i], &history);
+
+		if (score >= beta) {
+			*leaf = childLeaf;
+			return beta;
+		}
+
+		if (score > alpha) {
+			alpha = score;
+			*leaf = childLeaf;
+		}
+	}
+
+	return alpha;
+}
+
+/*
+ * Counts how many times every feature appears for white minus for black.
+ * It has to match the way the evaluation uses each parameter.
+ */
+static int extractFeatures(const Board *board, const AttackInfo *info, Feature *list) {
+	int values[N_FEATURES] = {0};
+
+	for (int color = WHITE; color <= BLACK; ++color) {
+		const int sign = (color == WHITE) ? 1 : -1;
+		const uint64_t safe = ~board->players[color] & ~info->attacks[1 ^ color][PAWN];
+
+		for (int piece = PAWN; piece <= KING; ++piece) {
+			uint64_t bb = board->pieces[color][piece];
+
+			if (bb) do {
+				const int sqr = bitScanForward(bb);
+				const int index = (color == WHITE) ? sqr : mirrorLSB(bb);
+
+				values[piece] += sign;
+				values[PST_FEATURE(piece, index)] += sign;
+
+				if (piece >= KNIGHT && piece <= QUEEN)
+					values[MOBILITY_FEATURE(piece)] += sign * popCount(info->pieceAttacks[sqr] & safe);
+			} while (unsetLSB(bb));
+		}
+	}
+
+	int count = 0;
+
+	for (int i = 0; i < N_FEATURES; ++i) {
+		if (values[i])
+			list[count++] = (Feature){.index = i, .value = values[i]};
+	}
+
+	return count;
+}
+
+/*
+ * Evaluates a sample from white's point of view with the current parameters.
+ * Material isn't tapered, so it only uses the opening parameter.
+ */
+static double evalSample(const Sample *sample, const Feature *f) {
+	double opening = 0, endgame = 0, material = 0;
+
+	for (int i = 0; i < sample->count; ++i) {
+		if (f[i].index < PST_FEATURE(PAWN, 0)) {
+			material += f[i].value * params[OPENING][f[i].index];
+		} else {
+			opening += f[i].value * params[OPENING][f[i].index];
+			endgame += f[i].value * params[ENDGAME][f[i].index];
+		}
+	}
+
+	return sample->offset + material +
+			(opening * (256 - sample->phase) + endgame * sample->phase) / 256;
+}
+
+/*
+ * Returns the cross-entropy between the results and the predicted scores.
+ * The gradient with respect to every parameter is stored unless it's NULL.
+ */
+static double computeLoss(const double k, const int threads, double gradient[PHASES][N_FEATURES]) {
+	pthread_t workers[threads];
+	Worker *args = malloc(threads * sizeof(Worker));
+
+	const uint64_t chunk = nSamples / threads + 1;
+
+	for (int i = 0; i < threads; ++i) {
+		args[i].start = (i * chunk < nSamples) ? i * chunk : nSamples;
+		args[i].end = ((i + 1) * chunk < nSamples) ? (i + 1) * chunk : nSamples;
+		args[i].k = k;
+		args[i].needGradient = gradient != NULL;
+
+		pthread_create(&workers[i], NULL, lossRange, &args[i]);
+	}
+
+	double loss = 0;
+
+	if (gradient)
+		memset(gradient, 0, PHASES * N_FEATURES * sizeof(double));
+
+	for (int i = 0; i < threads; ++i) {
+		pthread_join(workers[i], NULL);
+
+		loss += args[i].loss;
+
+		if (gradient == NULL)
+			continue;
+
+		for (int phase = 0; phase < PHASES; ++phase) {
+			for (int j = 0; j < N_FEATURES; ++j)
+				gradient[phase][j] += args[i].gradient[phase][j] / nSamples;
+		}
+	}
+
+	free(args);
+
+	return loss / nSamples;
+}
+
+/*
+ * Sums the loss over the samples of the worker, and their gradient
+ * unless only the loss is needed.
+ */
+static void *lossRange(void *args) {
+	Worker *worker = (Worker *) args;
+
+	const int needGradient = worker->needGradient;
+	const double k = worker->k;
+
+	worker->loss = 0;
+
+	if (needGradient)
+		memset(worker->gradient, 0, sizeof(worker->gradient));
+
+	for (uint64_t i = worker->start; i < worker->end; ++i) {
+		const Sample *sample = &samples[i];
+		const Feature *f = &features[sample->start];
+		const double p = fmin(fmax(sigmoid(k, evalSample(sample, f)), 1e-9), 1 - 1e-9);
+
+		worker->loss -= sample->result * log(p) + (1 - sample->result) * log(1 - p);
+
+		if (!needGradient)
+			continue;
+
+		const double error = (p - sample->result) * k * log(10.0) / 400.0;
+
+		for (int j = 0; j < sample->count; ++j) {
+			if (f[j].index < PST_FEATURE(PAWN, 0)) {
+				worker->gradient[OPENING][f[j].index] += error * f[j].value;
+			} else {
+				worker->gradient[OPENING][f[j].index] += error * f[j].value * (256 - sample->phase) / 256;
+				worker->gradient[ENDGAME][f[j].index] += error * f[j].value * sample->phase / 256;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Finds the scaling factor that best maps the current evaluation
+ * to the results with a golden section search.
+ */
+static double bestScalingFactor(const int threads) {
+	const double ratio = (sqrt(5.0) - 1) / 2;
+
+	double a = 0.1, b = 3.0;
+
+	for (int i = 0; i < 30; ++i) {
+		const double c = b - ratio * (b - a);
+		const double d = a + ratio * (b - a);
+
+		if (computeLoss(c, threads, NULL) < computeLoss(d, threads, NULL))
+			b = d;
+		else
+			a = c;
+	}
+
+	return (a + b) / 2;
+}
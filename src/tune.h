@@ -0,0 +1,8 @@
+#ifndef SRC_TUNE_H_
+#define SRC_TUNE_H_
+
+#define TUNE_OUTPUT "tuned.txt"
+
+void tune(const char *filename, const int threads, const int epochs);
+
+#endif /* SRC_TUNE_H_ */
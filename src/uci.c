@@ -7,10 +7,13 @@
 #include "board.h"
 #include "play.h"
 #include "search.h"
+#include "sort.h"
 #include "eval.h"
 #include "hashtables.h"
 #include "uci.h"
 #include "draw.h"
+#include "egtb.h"
+#include "numa.h"
 
 
 static void isready(void);
@@ -18,29 +21,58 @@ static void position(Board *board, char *s);
 static void go(Board *board, Settings *settings, char *s);
 static void setoption(Settings *settings, char *s);
 
-pthread_t worker;
-int working = 0;
+static void *searchLoop(void *args);
+static void waitSearchThread(void);
+static void ponderhitSearchThread(void);
+
+/*
+ * The search runs in a thread created once per session. Between searches
+ * it's parked on a condition variable, so a go only has to wake it up and
+ * its stack stays warm.
+ */
+static pthread_t worker;
+static pthread_mutex_t workerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workerWake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t workerIdle = PTHREAD_COND_INITIALIZER;
+
+// Signalled on the ponderhit and the stop, which release the bestmove of a ponder search
+static pthread_cond_t ponderDone = PTHREAD_COND_INITIALIZER;
+
+static Board *searchBoard;
+static int working = 0;
+static int quitting = 0;
 
 void uci(void) {
 
 	fprintf(stdout, "id name %s\n", ENGINE_NAME);
 	fprintf(stdout, "id author %s\n", ENGINE_AUTHOR);
 	fprintf(stdout, "option name hash type spin default 128 min 1 max 2048\n");
+	fprintf(stdout, "option name egtbpath type string default %s\n", EGTB_PATH);
+	fprintf(stdout, "option name probcutmargin type spin default %d min 0 max 1000\n", PROBCUT_MARGIN);
+	fprintf(stdout, "option name probcutdepth type spin default %d min 2 max %d\n", PROBCUT_DEPTH, MAX_DEPTH);
+	fprintf(stdout, "option name numa type check default true\n");
+	fprintf(stdout, "option name Ponder type check default false\n");
 	fprintf(stdout, "uciok\n");
 	fflush(stdout);
 
+	printNumaInfo();
+
 	Board board;
 	initialBoard(&board);
 
+	initSearchThread();
+
 	char msg[4096];
 
 	while (fgets(msg, 4096, stdin) != NULL) {
 
 		if (strncmp(msg, "isready", 7) == 0)
 			isready();
-		else if (strncmp(msg, "ucinewgame", 10) == 0)
+		else if (strncmp(msg, "ucinewgame", 10) == 0) {
+			// The history of a previous game doesn't carry over, but it does between its moves
+			clearHistory();
 			initialBoard(&board);
-		else if (strncmp(msg, "position", 8) == 0)
+		} else if (strncmp(msg, "position", 8) == 0)
 			position(&board, msg + 9);
 		else if (strncmp(msg, "eval", 4) == 0)
 			evaluate(&board);
@@ -48,17 +80,15 @@ void uci(void) {
 			go(&board, &settings, msg + 2);
 		else if (strncmp(msg, "setoption name", 14) == 0)
 			setoption(&settings, msg + 15);
-		else if (strncmp(msg, "stop", 4) == 0) {
-			settings.stop = 1;
-
-			if (working)
-				stopSearchThread();
-		} else if (strncmp(msg, "quit", 4) == 0)
+		else if (strncmp(msg, "ponderhit", 9) == 0)
+			ponderhitSearchThread();
+		else if (strncmp(msg, "stop", 4) == 0)
+			stopSearchThread();
+		else if (strncmp(msg, "quit", 4) == 0)
 			break;
 	}
 
-	if (working)
-		stopSearchThread();
+	quitSearchThread();
 }
 
 // Lets the GUI know the engine is ready. Serves as a ping.
@@ -89,6 +119,9 @@ static void position(Board *board, char *s) {
 }
 
 static void go(Board *board, Settings *settings, char *s) {
+	// The settings can't change under a running search
+	waitSearchThread();
+
 	defaultSettings(settings);
 
 	while (s[1] != '\0' && s[1] != '\n') {
@@ -116,12 +149,21 @@ static void go(Board *board, Settings *settings, char *s) {
 		} else if (strncmp(s, "movetime", 8) == 0) {
 			s += 9;
 			settings->movetime = atoi(s);
+		} else if (strncmp(s, "nodes", 5) == 0) {
+			s += 6;
+			settings->nodes = strtoull(s, NULL, 10);
+		} else if (strncmp(s, "mate", 4) == 0) {
+			s += 5;
+			settings->mate = atoi(s);
+		} else if (strncmp(s, "ponder", 6) == 0) {
+			s += 6;
+			settings->ponder = 1;
 		}
 
 		++s;
 	}
 
-	createSearchThread(board);
+	startSearchThread(board);
 }
 
 // Options are expected to be in the form:
@@ -131,6 +173,21 @@ static void setoption(Settings *settings, char *s) {
 
 	if (strncmp(s, "hash", 4) == 0)
 		resizeTT(atoi(s + 11));
+	else if (strncmp(s, "egtbpath", 8) == 0) {
+		s[strcspn(s, "\r\n")] = '\0';
+		loadEGTB(s + 15);
+	}
+	else if (strncmp(s, "probcutmargin", 13) == 0)
+		probCutMargin = atoi(s + 20);
+	else if (strncmp(s, "probcutdepth", 12) == 0)
+		probCutDepth = max(2, atoi(s + 19));
+	else if (strncmp(s, "numa", 4) == 0) {
+		numaBinding = strncmp(s + 11, "true", 4) == 0;
+		bindToNumaNode();
+		printNumaInfo();
+	}
+	else if (strncmp(s, "Ponder", 6) == 0)
+		ponderEnabled = strncmp(s + 13, "true", 4) == 0;
 }
 
 void playMoves(Board *board, char *moves) {
@@ -155,7 +212,25 @@ void *bestmove(void *args) {
 	const Move move = search(board);
 	moveToText(move, pv);
 
-	fprintf(stdout, "bestmove %s\n", pv);
+	// The bestmove of a ponder search can't be sent before the ponderhit or the stop
+	pthread_mutex_lock(&workerLock);
+
+	while (settings.ponder && !settings.stop)
+		pthread_cond_wait(&ponderDone, &workerLock);
+
+	pthread_mutex_unlock(&workerLock);
+
+	Move reply;
+
+	if (ponderEnabled && getPonderMove(&reply)) {
+		char ponder[6];
+		moveToText(reply, ponder);
+
+		fprintf(stdout, "bestmove %s ponder %s\n", pv, ponder);
+	} else {
+		fprintf(stdout, "bestmove %s\n", pv);
+	}
+
 	fflush(stdout);
 
 	return NULL;
@@ -182,16 +257,88 @@ void infoString(const Board *board, const int depth, const int score, const uint
 	fflush(stdout);
 }
 
-void createSearchThread(Board *board) {
-	if (working)
-		pthread_join(worker, NULL);
+void initSearchThread(void) {
+	quitting = 0;
+	pthread_create(&worker, NULL, searchLoop, NULL);
+}
+
+// Wakes the search thread up, once the previous search has finished
+void startSearchThread(Board *board) {
+	pthread_mutex_lock(&workerLock);
+
+	while (working)
+		pthread_cond_wait(&workerIdle, &workerLock);
 
-	pthread_create(&worker, NULL, bestmove, (void *) board);
+	searchBoard = board;
 	working = 1;
+
+	pthread_cond_signal(&workerWake);
+	pthread_mutex_unlock(&workerLock);
 }
 
 void stopSearchThread(void) {
+	pthread_mutex_lock(&workerLock);
 	settings.stop = 1;
+	pthread_cond_signal(&ponderDone);
+	pthread_mutex_unlock(&workerLock);
+
+	waitSearchThread();
+}
+
+void quitSearchThread(void) {
+	stopSearchThread();
+
+	pthread_mutex_lock(&workerLock);
+	quitting = 1;
+	pthread_cond_signal(&workerWake);
+	pthread_mutex_unlock(&workerLock);
+
 	pthread_join(worker, NULL);
-	working = 0;
+}
+
+static void waitSearchThread(void) {
+	pthread_mutex_lock(&workerLock);
+
+	while (working)
+		pthread_cond_wait(&workerIdle, &workerLock);
+
+	pthread_mutex_unlock(&workerLock);
+}
+
+// The ponder search goes on as a timed one, and its bestmove can be sent
+static void ponderhitSearchThread(void) {
+	pthread_mutex_lock(&workerLock);
+	ponderhit();
+	pthread_cond_signal(&ponderDone);
+	pthread_mutex_unlock(&workerLock);
+}
+
+// Body of the search thread: searches every board it's given until it's told to quit
+static void *searchLoop(void *args) {
+	(void) args;
+
+	pthread_mutex_lock(&workerLock);
+
+	while (1) {
+		while (!working && !quitting)
+			pthread_cond_wait(&workerWake, &workerLock);
+
+		if (quitting)
+			break;
+
+		pthread_mutex_unlock(&workerLock);
+
+		// Follows the changes of the numa option
+		bindToNumaNode();
+		bestmove(searchBoard);
+
+		pthread_mutex_lock(&workerLock);
+
+		working = 0;
+		pthread_cond_broadcast(&workerIdle);
+	}
+
+	pthread_mutex_unlock(&workerLock);
+
+	return NULL;
 }
@@ -11,7 +11,9 @@ void playMoves(Board *board, char *moves);
 
 void *bestmove(void *args);
 
-void createSearchThread(Board *board);
+void initSearchThread(void);
+void startSearchThread(Board *board);
 void stopSearchThread(void);
+void quitSearchThread(void);
 
 #endif /* SRC_UCI_H_ */